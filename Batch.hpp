@@ -0,0 +1,357 @@
+/**
+ * @file Batch.hpp
+ * @author Fabian Wiesner (fabian.wiesner97@gmail.com)
+ * @brief Batches of real amplitudes, one per sample of the rotation errors, to run many calibrations of the wave plates in one pass of the circuit.
+ * @version 0.1
+ * @date 2024-06-06
+ *
+ * @copyright Copyright (c) 2024, provided under CC BY-NC 4.0. license
+ *
+ */
+
+ /*
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef BATCH_HPP
+#define BATCH_HPP
+#include <cmath>
+#include <type_traits>
+#include "Kernels.hpp"
+
+/*
+The rotation errors only change the amplitudes of the circuit, never its keys. A Batch<Real, N> holds the amplitudes of N samples of the errors
+(cf. genRotationsBasic() for samples), such that one traversal of the keys computes all N samples. All operations act on every sample separately
+in a loop over the N samples, which the compiler vectorizes. N = 16 fills 64 bytes with float, i.e. one cache line and one AVX-512 register.
+A key is kept by the truncation if it is above the tolerance in any sample: comparisons and the conversion to a real number use the largest absolute
+value of the samples, cf. Batch::top(). Likewise std::abs() of a Batch is a Real, it is only used for the tolerances and for the overlaps of the wave
+functions, which are the same in all samples.
+*/
+
+/**
+ * @brief Batch of N real numbers, one per sample.
+ *
+ * @tparam Real Real number type, e.g. float
+ * @tparam N Number of samples
+ */
+template<class Real, int N>
+class Batch{
+    /**
+     * @brief Value of sample l in x[l].
+     *
+     */
+    Real x[N] = {};
+
+    public:
+
+        /**
+         * @brief Number of samples.
+         *
+         */
+        static const int width = N;
+
+        /**
+         * @brief Construct a new Batch object with value 0 in all samples.
+         *
+         */
+        Batch(){}
+
+        /**
+         * @brief Construct a new Batch object with the same value in all samples.
+         *
+         * @tparam T Arithmetic type
+         * @param v Value
+         */
+        template<class T, class = typename std::enable_if<std::is_arithmetic<T>::value>::type>
+        Batch(T v){
+            for (int l = 0; l<N; l++)
+                x[l] = (Real) v;
+        }
+
+        /**
+         * @brief Converts a Batch in a different precision, e.g. to accumulate in double (cf. Accum).
+         *
+         * @tparam Real2 Real number type of b
+         * @param b Batch to convert
+         */
+        template<class Real2>
+        explicit Batch(const Batch<Real2, N>& b){
+            for (int l = 0; l<N; l++)
+                x[l] = (Real) b[l];
+        }
+
+        /**
+         * @brief Largest absolute value of the samples.
+         *
+         * @return Real Largest absolute value
+         */
+        inline Real top() const {
+            Real t = 0;
+            for (int l = 0; l<N; l++)
+                t = std::max(t, (Real) std::abs(x[l]));
+            return t;
+        }
+
+        /**
+         * @brief Converts to the largest absolute value of the samples, cf. top().
+         *
+         * @tparam T Arithmetic type
+         * @return T Largest absolute value
+         */
+        template<class T, class = typename std::enable_if<std::is_arithmetic<T>::value>::type>
+        explicit inline operator T() const {return (T) top();}
+
+        /**
+         * @brief Value of sample l.
+         *
+         * @param l Sample
+         * @return Real Value
+         */
+        inline Real operator[](int l) const {return x[l];}
+
+        /**
+         * @brief Value of sample l.
+         *
+         * @param l Sample
+         * @return Real& Value
+         */
+        inline Real& operator[](int l){return x[l];}
+
+        /**
+         * @brief Applies a function to every sample.
+         *
+         * @tparam F Callable Real -> Real
+         * @param f Function
+         * @return Batch f of every sample
+         */
+        template<class F>
+        inline Batch map(F f) const {
+            Batch r;
+            for (int l = 0; l<N; l++)
+                r.x[l] = f(x[l]);
+            return r;
+        }
+
+        /**
+         * @brief Negation.
+         *
+         * @return Batch -this
+         */
+        inline Batch operator-() const {
+            Batch r;
+            for (int l = 0; l<N; l++)
+                r.x[l] = -x[l];
+            return r;
+        }
+
+        /**
+         * @brief Addition.
+         *
+         * @param b Summand
+         * @return Batch& This
+         */
+        inline Batch& operator+=(const Batch& b){
+            for (int l = 0; l<N; l++)
+                x[l] += b.x[l];
+            return *this;
+        }
+
+        /**
+         * @brief Addition of a Batch in a different precision, e.g. to accumulate float Batches in double (cf. Accum).
+         *
+         * @tparam Real2 Real number type of b
+         * @param b Summand
+         * @return Batch& This
+         */
+        template<class Real2>
+        inline Batch& operator+=(const Batch<Real2, N>& b){
+            for (int l = 0; l<N; l++)
+                x[l] += b[l];
+            return *this;
+        }
+
+        /**
+         * @brief Subtraction.
+         *
+         * @param b Subtrahend
+         * @return Batch& This
+         */
+        inline Batch& operator-=(const Batch& b){
+            for (int l = 0; l<N; l++)
+                x[l] -= b.x[l];
+            return *this;
+        }
+
+        /**
+         * @brief Multiplication.
+         *
+         * @param b Factor
+         * @return Batch& This
+         */
+        inline Batch& operator*=(const Batch& b){
+            for (int l = 0; l<N; l++)
+                x[l] *= b.x[l];
+            return *this;
+        }
+
+        /**
+         * @brief Division.
+         *
+         * @param b Divisor
+         * @return Batch& This
+         */
+        inline Batch& operator/=(const Batch& b){
+            for (int l = 0; l<N; l++)
+                x[l] /= b.x[l];
+            return *this;
+        }
+
+        /**
+         * @brief Sum, constants are converted implicitly.
+         *
+         * @param a Summand
+         * @param b Summand
+         * @return Batch a+b
+         */
+        friend inline Batch operator+(Batch a, const Batch& b){return a += b;}
+
+        /**
+         * @brief Difference, constants are converted implicitly.
+         *
+         * @param a Minuend
+         * @param b Subtrahend
+         * @return Batch a-b
+         */
+        friend inline Batch operator-(Batch a, const Batch& b){return a -= b;}
+
+        /**
+         * @brief Product, constants are converted implicitly.
+         *
+         * @param a Factor
+         * @param b Factor
+         * @return Batch a*b
+         */
+        friend inline Batch operator*(Batch a, const Batch& b){return a *= b;}
+
+        /**
+         * @brief Quotient, constants are converted implicitly.
+         *
+         * @param a Dividend
+         * @param b Divisor
+         * @return Batch a/b
+         */
+        friend inline Batch operator/(Batch a, const Batch& b){return a /= b;}
+
+        /**
+         * @brief Equality of the largest absolute values, cf. top().
+         *
+         * @param a Batch
+         * @param b Batch
+         * @return bool Whether the largest absolute values are equal
+         */
+        friend inline bool operator==(const Batch& a, const Batch& b){return a.top() == b.top();}
+
+        /**
+         * @brief Inequality of the largest absolute values, cf. top().
+         *
+         * @param a Batch
+         * @param b Batch
+         * @return bool Whether the largest absolute values differ
+         */
+        friend inline bool operator!=(const Batch& a, const Batch& b){return a.top() != b.top();}
+
+        /**
+         * @brief Order of the largest absolute values, cf. top().
+         *
+         * @param a Batch
+         * @param b Batch
+         * @return bool Whether the largest absolute value of a is smaller
+         */
+        friend inline bool operator<(const Batch& a, const Batch& b){return a.top() < b.top();}
+
+        /**
+         * @brief Order of the largest absolute values, cf. top().
+         *
+         * @param a Batch
+         * @param b Batch
+         * @return bool Whether the largest absolute value of a is larger
+         */
+        friend inline bool operator>(const Batch& a, const Batch& b){return a.top() > b.top();}
+};
+
+/**
+ * @brief Batches are accumulated in the accumulation type of their samples, cf. Accum.
+ *
+ * @tparam Real Real number type
+ * @tparam N Number of samples
+ */
+template<class Real, int N>
+struct Accum<Batch<Real, N>>{using type = Batch<typename Accum<Real>::type, N>;};
+
+/**
+ * @brief Squares of all samples, cf. absSq().
+ *
+ * @tparam Real Real number type
+ * @tparam N Number of samples
+ * @param v Batch
+ * @return Batch<Real, N> v^2 in every sample
+ */
+template<class Real, int N>
+inline Batch<Real, N> absSq(const Batch<Real, N>& v){return v*v;}
+
+/**
+ * @brief Complex conjugate, i.e. the Batch itself.
+ *
+ * @tparam Real Real number type
+ * @tparam N Number of samples
+ * @param v Batch
+ * @return Batch<Real, N> v
+ */
+template<class Real, int N>
+inline Batch<Real, N> conj(const Batch<Real, N>& v){return v;}
+
+/**
+ * @brief Largest absolute value of the samples, cf. Batch::top() and Batch.hpp.
+ *
+ * @tparam Real Real number type
+ * @tparam N Number of samples
+ * @param v Batch
+ * @return Real Largest absolute value
+ */
+template<class Real, int N>
+inline Real abs(const Batch<Real, N>& v){return v.top();}
+
+/**
+ * @brief Square root of all samples.
+ *
+ * @tparam Real Real number type
+ * @tparam N Number of samples
+ * @param v Batch
+ * @return Batch<Real, N> sqrt(v) in every sample
+ */
+template<class Real, int N>
+inline Batch<Real, N> sqrt(const Batch<Real, N>& v){return v.map([](Real a){return std::sqrt(a);});}
+
+/**
+ * @brief Appends results to out, sample by sample, i.e. all results of sample 0, then all results of sample 1, ...
+ *
+ * @tparam R Real number type of the output
+ * @tparam Real Real number type
+ * @tparam N Number of samples
+ * @param x Results
+ * @param out Output: the samples are appended
+ */
+template<class R, class Real, int N>
+inline void toReals(const std::vector<Batch<Real, N>>& x, std::vector<R>& out){
+    for (int l = 0; l<N; l++)
+        for (const Batch<Real, N>& v : x)
+            out.push_back((R) v[l]);
+}
+
+#endif
@@ -0,0 +1,322 @@
+/**
+ * @file BlockState.hpp
+ * @author Fabian Wiesner (fabian.wiesner97@gmail.com)
+ * @brief Defines BlockState, a State layout indexed by the distinguishability signature of the keys.
+ * @version 0.1
+ * @date 2024-06-06
+ *
+ * @copyright Copyright (c) 2024, provided under CC BY-NC 4.0.
+ *
+ */
+
+ /*
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef BLOCKSTATE_HPP
+#define BLOCKSTATE_HPP
+
+#include "State.hpp"
+
+/**
+ * @brief Block of keys with the same distinguishability signature. The spatial parts of the keys are stored contiguously.
+ *
+ * @tparam Int Integer number type, cf. Key
+ * @tparam Val Amplitude type, cf. State
+ */
+template<class Int, class Val>
+class StateBlock{
+    public:
+
+        /**
+         * @brief Number of entries of every key, i.e. the length of the signature.
+         *
+         */
+        size_t width = 0;
+
+        /**
+         * @brief Spatial parts, key i is (mode, occupation number) for all entries in data[2*width*i, 2*width*(i+1)).
+         *
+         */
+        std::vector<Int> data;
+
+        /**
+         * @brief Amplitudes, one per key.
+         *
+         */
+        std::vector<Val> amps;
+
+        /**
+         * @brief Construct a new StateBlock object.
+         *
+         * @param w Number of entries of every key
+         */
+        StateBlock(size_t w = 0){width = w;}
+
+        /**
+         * @brief Number of keys.
+         *
+         * @return size_t Number of keys
+         */
+        inline size_t size() const {return amps.size();}
+
+        /**
+         * @brief Appends a key.
+         *
+         * @param d Spatial part of the key, 2*width entries
+         * @param v Amplitude
+         */
+        inline void push(const Int* d, const Val& v){
+            data.insert(data.end(), d, d+2*width);
+            amps.push_back(v);
+        }
+
+        /**
+         * @brief Sorts the keys by their spatial part and adds the amplitudes of equal keys.
+         *
+         */
+        inline void merge(){
+            size_t w = 2*width;
+            std::vector<size_t> idx(size());
+            for (size_t i = 0; i<idx.size(); i++) idx[i] = i;
+            const Int* d = data.data();
+            std::stable_sort(idx.begin(), idx.end(), [d, w](size_t a, size_t b){return std::lexicographical_compare(d+a*w, d+(a+1)*w, d+b*w, d+(b+1)*w);});
+            std::vector<Int> data2;
+            std::vector<Val> amps2;
+            data2.reserve(data.size());
+            amps2.reserve(amps.size());
+            for (size_t i : idx){
+                if (!amps2.empty() && std::equal(d+i*w, d+(i+1)*w, data2.end()-w))
+                    amps2.back() += amps[i];
+                else {
+                    data2.insert(data2.end(), d+i*w, d+(i+1)*w);
+                    amps2.push_back(amps[i]);
+                }
+            }
+            data = std::move(data2);
+            amps = std::move(amps2);
+        }
+};
+
+/**
+ * @brief Two-level layout of a State. The outer index is the signature of a key, i.e. the sequence of Distinguishability modes of its entries.
+ * The inner blocks contain the spatial parts, i.e. the S&P modes and occupation numbers, and the amplitudes of the keys with this signature.
+ *
+ * A collapse (cf. State::collapse()) relabels the signature once per block and only merges the spatial parts of the keys, without allocating keys.
+ *
+ * @tparam Key Key type used in the State
+ * @tparam Val Amplitude type used in the State, e.g. float or std::complex<float>
+ * @tparam Real Real number type that should be used, e.g. float.
+ */
+template<class Key, class Val, class Real>
+class BlockState : public boost::container::flat_map<std::vector<typename Key::basetype>, StateBlock<typename Key::basetype, Val>>{
+    /**
+     * @brief Handle for the user integer number type from Key.
+     *
+     */
+    using Int = typename Key::basetype;
+
+    /**
+     * @brief Signature of a block, the Distinguishability modes of the entries of the keys.
+     *
+     */
+    using Sig = std::vector<Int>;
+
+    /**
+     * @brief Short handle for the block type.
+     *
+     */
+    using Block = StateBlock<Int, Val>;
+
+    /**
+     * @brief Short handle for the parent type that provides the actual data structure.
+     *
+     */
+    using Par = boost::container::flat_map<Sig, Block>;
+
+    public:
+
+        /**
+         * @brief Construct a new (empty) BlockState object.
+         *
+         */
+        BlockState(){}
+
+        /**
+         * @brief Construct a new BlockState object from a State.
+         *
+         * @param S State to convert
+         */
+        BlockState(const State<Key, Val, Real>& S){set(S);}
+
+        /**
+         * @brief Sets the data to the data of a State.
+         *
+         * @param S State to convert
+         */
+        inline void set(const State<Key, Val, Real>& S);
+
+        /**
+         * @brief Converts back to a State.
+         *
+         * @return State<Key, Val, Real> The State
+         */
+        inline State<Key, Val, Real> get() const;
+
+        /**
+         * @brief Number of keys in all blocks.
+         *
+         * @return size_t Number of keys
+         */
+        inline size_t keys() const;
+
+        /**
+        * @brief Returns the norm of a state
+        *
+        * @return Real The norm of the state
+        */
+        inline Real norm() const;
+
+        /**
+        * @brief Returns the squared norm of a state, accumulated in higher precision, cf. State::normSq().
+        *
+        * @return sqnorm_t<Val> The squared norm of the state
+        */
+        inline sqnorm_t<Val> normSq() const;
+
+        /**
+        * @brief Maps the current distinguishability conf to a different one - Only use for mapping to less distinguishable conf, cf. State::collapse().
+        *
+        * @param K Key that encodes the target distinguishability configuration.
+        */
+        inline void collapse(const Key& K);
+};
+
+template<class Key, class Val, class Real>
+inline void BlockState<Key, Val, Real>::set(const State<Key, Val, Real>& S){
+    Par::clear();
+    Sig s;
+    std::vector<Int> d;
+    std::pair<typename Par::iterator, bool> pib;
+    for (typename State<Key, Val, Real>::const_iterator it = S.cbegin(); it != S.cend(); it++){
+        s.clear();
+        d.clear();
+        for (typename Key::const_iterator kit = it->first.cbegin(); kit != it->first.cend(); kit++){
+            s.push_back(kit->first.second);
+            d.push_back(kit->first.first);
+            d.push_back(kit->second);
+        }
+        pib = Par::emplace(s, Block(s.size()));
+        pib.first->second.push(d.data(), it->second);
+    }
+}
+
+template<class Key, class Val, class Real>
+inline State<Key, Val, Real> BlockState<Key, Val, Real>::get() const {
+    State<Key, Val, Real> S;
+    Key K;
+    for (typename Par::const_iterator it = Par::cbegin(); it != Par::cend(); it++){
+        const Block& B = it->second;
+        for (size_t i = 0; i<B.size(); i++){
+            K.clear();
+            for (size_t e = 0; e<B.width; e++)
+                K.addEnd(B.data[2*(B.width*i+e)], it->first[e], B.data[2*(B.width*i+e)+1]);
+            S.set(K, B.amps[i]);
+        }
+    }
+    return S;
+}
+
+template<class Key, class Val, class Real>
+inline size_t BlockState<Key, Val, Real>::keys() const {
+    size_t n = 0;
+    for (typename Par::const_iterator it = Par::cbegin(); it != Par::cend(); it++)
+        n += it->second.size();
+    return n;
+}
+
+template<class Key, class Val, class Real>
+inline sqnorm_t<Val> BlockState<Key, Val, Real>::normSq() const {
+    std::vector<sqnorm_t<Val>> part(Par::size(), 0.0);
+    KERNEL_PARALLEL_FOR(part.size())
+    for (size_t k = 0; k<part.size(); k++)
+        part[k] = sqNorm((Par::cbegin()+k)->second.amps.data(), (Par::cbegin()+k)->second.size());
+    sqnorm_t<Val> r = 0;
+    for (const sqnorm_t<Val>& x : part) //in the order of the blocks, independent of the threads
+        r += x;
+    return r;
+}
+
+template<class Key, class Val, class Real>
+inline Real BlockState<Key, Val, Real>::norm() const {
+    using std::sqrt;
+    return (Real) sqrt(normSq());
+}
+
+template<class Key, class Val, class Real>
+inline void BlockState<Key, Val, Real>::collapse(const Key& K){
+    std::vector<Int> f, g;
+    for (typename Key::const_iterator it=K.cbegin(); it!=K.cend(); it++)
+        f.push_back(it->first.second);
+    std::map<Sig, Block> p;
+    std::vector<std::array<Int, 3>> e;
+    Sig s;
+    std::vector<Int> d;
+    Val v;
+    Int pre, post;
+    using std::sqrt;
+    typename std::map<Sig, Block>::iterator pit = p.end();
+    for (typename Par::iterator it = Par::begin(); it != Par::end(); it++){
+        const Block& B = it->second;
+        e.resize(B.width);
+        g.clear();
+        for (Int d0 : it->first)
+            g.push_back(f.at(d0));
+        for (size_t i = 0; i<B.size(); i++){
+            pre = 1;
+            for (size_t j = 0; j<B.width; j++){
+                e[j] = {B.data[2*(B.width*i+j)], g[j], B.data[2*(B.width*i+j)+1]};
+                pre *= facut(e[j][2]);
+            }
+            for (size_t j = 1; j<B.width; j++) //entries are sorted by mode already, only entries of the same mode may need to be swapped
+                for (size_t k = j; k>0 && e[k-1][0] == e[k][0] && e[k-1][1] > e[k][1]; k--)
+                    std::swap(e[k-1], e[k]);
+            s.clear();
+            d.clear();
+            for (size_t j = 0; j<B.width; j++){
+                if (!s.empty() && d[d.size()-2] == e[j][0] && s.back() == e[j][1])
+                    d.back() += e[j][2];
+                else {
+                    s.push_back(e[j][1]);
+                    d.push_back(e[j][0]);
+                    d.push_back(e[j][2]);
+                }
+            }
+            post = 1;
+            for (size_t j = 1; j<d.size(); j+=2)
+                post *= facut(d[j]);
+            v = B.amps[i];
+            if (post != pre)
+                v *= sqrt((Val) post)/sqrt((Val) pre);
+            if (pit == p.end() || s != pit->first){ //consecutive keys mostly end up in the same block
+                pit = p.find(s);
+                if (pit == p.end())
+                    pit = p.emplace(s, Block(s.size())).first;
+            }
+            pit->second.push(d.data(), v);
+        }
+    }
+    Par::clear();
+    for (typename std::map<Sig, Block>::iterator it = p.begin(); it != p.end(); it++){
+        it->second.merge();
+        Par::insert(Par::cend(), std::make_pair(it->first, std::move(it->second)));
+    }
+}
+
+#endif
@@ -0,0 +1,438 @@
+/**
+ * @file Dual.hpp
+ * @author Fabian Wiesner (fabian.wiesner97@gmail.com)
+ * @brief Dual numbers for forward-mode differentiation of the simulation w.r.t. the rotation errors of the wave plates.
+ * @version 0.1
+ * @date 2024-06-06
+ *
+ * @copyright Copyright (c) 2024, provided under CC BY-NC 4.0. license
+ *
+ */
+
+ /*
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef DUAL_HPP
+#define DUAL_HPP
+#include <cmath>
+#include <type_traits>
+#include "KeyAux.hpp"
+#include "Kernels.hpp"
+
+/*
+A Dual<Real, N> is a value together with its partial derivatives w.r.t. N variables, e.g. the 15 rotation errors of genRotationsBasic().
+Used as amplitude type of State, one run of the circuit yields the amplitudes and all N partial derivatives of them, squared norms (absSq(), sqNorm())
+keep their derivatives, such that fidelities and probabilities come with their gradients (cf. toReals()).
+The value and the derivatives are stored in one array, every operation is a loop over all N+1 entries with a fix for the value entry, which the compiler
+vectorizes. N = 15 fills 64 bytes with float, i.e. one cache line and one AVX-512 register.
+A key is kept by the truncation if its value or one of its derivatives is above the tolerance, otherwise the derivatives of the kept amplitudes are
+biased: comparisons and the conversion to a real number use the largest absolute entry, cf. Dual::top() and Batch::top(). Likewise std::abs() of a
+Dual is a Real, it is only used for the tolerances and for the overlaps of the wave functions, which do not depend on the rotations. value() and
+deriv() give the entries themselves.
+*/
+
+/**
+ * @brief Dual number with N derivative lanes.
+ *
+ * @tparam Real Real number type, e.g. float
+ * @tparam N Number of derivative lanes
+ */
+template<class Real, int N>
+class Dual{
+    /**
+     * @brief Value in x[0], derivative w.r.t. variable l in x[l+1].
+     *
+     */
+    Real x[N+1] = {};
+
+    public:
+
+        /**
+         * @brief Construct a new Dual object with value 0.
+         *
+         */
+        Dual(){}
+
+        /**
+         * @brief Construct a new Dual object of a constant, i.e. with derivatives 0.
+         *
+         * @tparam T Arithmetic type
+         * @param v Value
+         */
+        template<class T, class = typename std::enable_if<std::is_arithmetic<T>::value>::type>
+        Dual(T v){x[0] = (Real) v;}
+
+        /**
+         * @brief Converts a Dual in a different precision, e.g. to accumulate in double (cf. Accum).
+         *
+         * @tparam Real2 Real number type of d
+         * @param d Dual to convert
+         */
+        template<class Real2>
+        explicit Dual(const Dual<Real2, N>& d){
+            for (int l = 0; l<=N; l++)
+                x[l] = (Real) d[l];
+        }
+
+        /**
+         * @brief Independent variable with value v, i.e. derivative 1 in lane l and 0 in all others. Lanes outside [0, N) are ignored, i.e. give a constant.
+         *
+         * @param v Value
+         * @param l Lane of the variable
+         * @return Dual The variable
+         */
+        static inline Dual variable(Real v, int l){
+            Dual d(v);
+            if (l >= 0 && l < N)
+                d.x[l+1] = 1;
+            return d;
+        }
+
+        /**
+         * @brief Largest absolute entry, i.e. of the value and the derivatives, used for the tolerances.
+         *
+         * @return Real Largest absolute entry
+         */
+        inline Real top() const {
+            Real t = 0;
+            for (int l = 0; l<=N; l++)
+                t = std::max(t, (Real) std::abs(x[l]));
+            return t;
+        }
+
+        /**
+         * @brief Converts to the largest absolute entry, cf. top(). The value itself is value().
+         *
+         * @tparam T Arithmetic type
+         * @return T Largest absolute entry
+         */
+        template<class T, class = typename std::enable_if<std::is_arithmetic<T>::value>::type>
+        explicit inline operator T() const {return (T) top();}
+
+        /**
+         * @brief Value.
+         *
+         * @return Real Value
+         */
+        inline Real value() const {return x[0];}
+
+        /**
+         * @brief Derivative w.r.t. variable l.
+         *
+         * @param l Lane
+         * @return Real Derivative
+         */
+        inline Real deriv(int l) const {return x[l+1];}
+
+        /**
+         * @brief Raw entry, the value for l = 0 and the derivative w.r.t. variable l-1 otherwise.
+         *
+         * @param l Entry
+         * @return Real Entry
+         */
+        inline Real operator[](int l) const {return x[l];}
+
+        /**
+         * @brief Chain rule, f(this) for a function with f(value) = f and f'(value) = df.
+         *
+         * @param f Value of the function
+         * @param df Derivative of the function
+         * @return Dual f(this)
+         */
+        inline Dual chain(Real f, Real df) const {
+            Dual r;
+            for (int l = 0; l<=N; l++)
+                r.x[l] = df*x[l];
+            r.x[0] = f;
+            return r;
+        }
+
+        /**
+         * @brief Negation.
+         *
+         * @return Dual -this
+         */
+        inline Dual operator-() const {
+            Dual r;
+            for (int l = 0; l<=N; l++)
+                r.x[l] = -x[l];
+            return r;
+        }
+
+        /**
+         * @brief Addition.
+         *
+         * @param d Summand
+         * @return Dual& This
+         */
+        inline Dual& operator+=(const Dual& d){
+            for (int l = 0; l<=N; l++)
+                x[l] += d.x[l];
+            return *this;
+        }
+
+        /**
+         * @brief Addition of a Dual in a different precision, e.g. to accumulate float Duals in double (cf. Accum).
+         *
+         * @tparam Real2 Real number type of d
+         * @param d Summand
+         * @return Dual& This
+         */
+        template<class Real2>
+        inline Dual& operator+=(const Dual<Real2, N>& d){
+            for (int l = 0; l<=N; l++)
+                x[l] += d[l];
+            return *this;
+        }
+
+        /**
+         * @brief Subtraction.
+         *
+         * @param d Subtrahend
+         * @return Dual& This
+         */
+        inline Dual& operator-=(const Dual& d){
+            for (int l = 0; l<=N; l++)
+                x[l] -= d.x[l];
+            return *this;
+        }
+
+        /**
+         * @brief Multiplication, product rule.
+         *
+         * @param d Factor
+         * @return Dual& This
+         */
+        inline Dual& operator*=(const Dual& d){
+            Real a = x[0], b = d.x[0];
+            for (int l = 0; l<=N; l++)
+                x[l] = x[l]*b+a*d.x[l];
+            x[0] = a*b;
+            return *this;
+        }
+
+        /**
+         * @brief Division, quotient rule.
+         *
+         * @param d Divisor
+         * @return Dual& This
+         */
+        inline Dual& operator/=(const Dual& d){
+            Real b = d.x[0], q = x[0]/b;
+            for (int l = 0; l<=N; l++)
+                x[l] = (x[l]-q*d.x[l])/b;
+            x[0] = q;
+            return *this;
+        }
+
+        /**
+         * @brief Sum, constants are converted implicitly.
+         *
+         * @param a Summand
+         * @param b Summand
+         * @return Dual a+b
+         */
+        friend inline Dual operator+(Dual a, const Dual& b){return a += b;}
+
+        /**
+         * @brief Difference, constants are converted implicitly.
+         *
+         * @param a Minuend
+         * @param b Subtrahend
+         * @return Dual a-b
+         */
+        friend inline Dual operator-(Dual a, const Dual& b){return a -= b;}
+
+        /**
+         * @brief Product, constants are converted implicitly.
+         *
+         * @param a Factor
+         * @param b Factor
+         * @return Dual a*b
+         */
+        friend inline Dual operator*(Dual a, const Dual& b){return a *= b;}
+
+        /**
+         * @brief Quotient, constants are converted implicitly.
+         *
+         * @param a Dividend
+         * @param b Divisor
+         * @return Dual a/b
+         */
+        friend inline Dual operator/(Dual a, const Dual& b){return a /= b;}
+
+        /**
+         * @brief Equality of the largest absolute entries, cf. top().
+         *
+         * @param a Dual
+         * @param b Dual
+         * @return bool Whether the largest absolute entries are equal
+         */
+        friend inline bool operator==(const Dual& a, const Dual& b){return a.top() == b.top();}
+
+        /**
+         * @brief Inequality of the largest absolute entries, cf. top().
+         *
+         * @param a Dual
+         * @param b Dual
+         * @return bool Whether the largest absolute entries differ
+         */
+        friend inline bool operator!=(const Dual& a, const Dual& b){return a.top() != b.top();}
+
+        /**
+         * @brief Order of the largest absolute entries, cf. top().
+         *
+         * @param a Dual
+         * @param b Dual
+         * @return bool Whether the largest absolute entry of a is smaller
+         */
+        friend inline bool operator<(const Dual& a, const Dual& b){return a.top() < b.top();}
+
+        /**
+         * @brief Order of the largest absolute entries, cf. top().
+         *
+         * @param a Dual
+         * @param b Dual
+         * @return bool Whether the largest absolute entry of a is larger
+         */
+        friend inline bool operator>(const Dual& a, const Dual& b){return a.top() > b.top();}
+};
+
+/**
+ * @brief Duals are accumulated in the accumulation type of their parts, cf. Accum.
+ *
+ * @tparam Real Real number type
+ * @tparam N Number of derivative lanes
+ */
+template<class Real, int N>
+struct Accum<Dual<Real, N>>{using type = Dual<typename Accum<Real>::type, N>;};
+
+/**
+ * @brief Square, which keeps the derivatives 2*v*dv, cf. absSq().
+ *
+ * @tparam Real Real number type
+ * @tparam N Number of derivative lanes
+ * @param v Number
+ * @return Dual<Real, N> v^2
+ */
+template<class Real, int N>
+inline Dual<Real, N> absSq(const Dual<Real, N>& v){return v.chain(v.value()*v.value(), 2*v.value());}
+
+/**
+ * @brief Weight for the truncation, the square of the largest absolute entry. absSq() would not do, its derivatives vanish with the value, such that
+ * amplitudes which cancel in the value but not in the derivatives would be dropped.
+ *
+ * @tparam Real Real number type
+ * @tparam N Number of derivative lanes
+ * @param v Number
+ * @return Real top()^2
+ */
+template<class Real, int N>
+inline Real truncWeight(const Dual<Real, N>& v){
+    Real t = v.top();
+    return t*t;
+}
+
+/**
+ * @brief Complex conjugate, i.e. the Dual itself.
+ *
+ * @tparam Real Real number type
+ * @tparam N Number of derivative lanes
+ * @param v Number
+ * @return Dual<Real, N> v
+ */
+template<class Real, int N>
+inline Dual<Real, N> conj(const Dual<Real, N>& v){return v;}
+
+/**
+ * @brief Largest absolute entry, cf. Dual::top().
+ *
+ * @tparam Real Real number type
+ * @tparam N Number of derivative lanes
+ * @param v Number
+ * @return Real Largest absolute entry
+ */
+template<class Real, int N>
+inline Real abs(const Dual<Real, N>& v){return v.top();}
+
+/**
+ * @brief Square root.
+ *
+ * @tparam Real Real number type
+ * @tparam N Number of derivative lanes
+ * @param v Number
+ * @return Dual<Real, N> sqrt(v)
+ */
+template<class Real, int N>
+inline Dual<Real, N> sqrt(const Dual<Real, N>& v){
+    Real s = std::sqrt(v.value());
+    return v.chain(s, 1/(2*s));
+}
+
+/**
+ * @brief Cosine.
+ *
+ * @tparam Real Real number type
+ * @tparam N Number of derivative lanes
+ * @param v Number
+ * @return Dual<Real, N> cos(v)
+ */
+template<class Real, int N>
+inline Dual<Real, N> cos(const Dual<Real, N>& v){return v.chain(std::cos(v.value()), -std::sin(v.value()));}
+
+/**
+ * @brief Sine.
+ *
+ * @tparam Real Real number type
+ * @tparam N Number of derivative lanes
+ * @param v Number
+ * @return Dual<Real, N> sin(v)
+ */
+template<class Real, int N>
+inline Dual<Real, N> sin(const Dual<Real, N>& v){return v.chain(std::sin(v.value()), std::cos(v.value()));}
+
+/**
+ * @brief Entries cos and sin of the rotation of wave plate i with error err (in degree), cf. genRotationsBasic(). Error i is the variable of lane i.
+ *
+ * @tparam Real Real number type
+ * @tparam N Number of derivative lanes
+ * @tparam R Real number type of the error
+ * @param err Rotation error
+ * @param i Index of the wave plate
+ * @param c Output: cos(45°+err)
+ * @param s Output: sin(45°+err)
+ */
+template<class Real, int N, class R>
+inline void rotation(R err, int i, Dual<Real, N>& c, Dual<Real, N>& s){
+    double a = (45.0+err)/180.0*numbers::pi, f = numbers::pi/180.0; //values as for real amplitudes
+    Dual<Real, N> e = Dual<Real, N>::variable(err, i);
+    c = e.chain((Real) std::cos(a), (Real) (-f*std::sin(a)));
+    s = e.chain((Real) std::sin(a), (Real) (f*std::cos(a)));
+}
+
+/**
+ * @brief Appends the values of results to out and then their derivatives, all N of every result in the order of the results.
+ *
+ * @tparam R Real number type of the output
+ * @tparam Real Real number type
+ * @tparam N Number of derivative lanes
+ * @param x Results
+ * @param out Output: the values and the derivatives are appended
+ */
+template<class R, class Real, int N>
+inline void toReals(const std::vector<Dual<Real, N>>& x, std::vector<R>& out){
+    for (const Dual<Real, N>& v : x)
+        out.push_back((R) v.value());
+    for (const Dual<Real, N>& v : x)
+        for (int l = 0; l<N; l++)
+            out.push_back((R) v.deriv(l));
+}
+
+#endif
@@ -0,0 +1,344 @@
+/**
+ * @file FidCheb.hpp
+ * @author Fabian Wiesner (fabian.wiesner97@gmail.com)
+ * @brief Defines the class FidCheb, a Chebyshev surrogate of the fidelity of one scenario over the rotation errors of the wave plates.
+ * @version 0.1
+ * @date 2024-06-06
+ *
+ * @copyright Copyright (c) 2024, provided under CC BY-NC 4.0. license
+ *
+ */
+
+ /*
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef FIDCHEB_HPP
+#define FIDCHEB_HPP
+#include <vector>
+#include <array>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include "KeyAux.hpp"
+#include "Kernels.hpp"
+
+/**
+ * @brief Surrogate of the probabilities and fidelities of one scenario as a function of the 15 rotation errors, for a list of overlaps.
+ *
+ * The entries of the rotations are cos and sin of the angles, such that the probabilities are trigonometric polynomials in the errors. On a box
+ * [-width, width]^15 they are approximated by polynomials of total degree at most deg in the Chebyshev polynomials T_k(err/width), which converge
+ * exponentially in deg. The probabilities and the probabilities of the GHZ state, i.e. probability times fidelity, are fitted by least squares, the
+ * fidelities are their ratio. Evaluation is a product of the Chebyshev basis of the query points with the coefficients.
+ *
+ * @tparam Real Real number type of the errors and the results, e.g. float. The fit is done in double.
+ */
+template<class Real>
+class FidCheb{
+    /**
+     * @brief Term of the basis, the product of T_k(err_i/width) for all pairs (i, k) with k>0.
+     *
+     */
+    using Term = std::vector<std::pair<int, int>>;
+
+    /**
+     * @brief Number of rotation errors.
+     *
+     */
+    static const int dims = 15;
+
+    /**
+     * @brief Maximal total degree of the terms.
+     *
+     */
+    int deg = 2;
+
+    /**
+     * @brief Half width of the box of the errors.
+     *
+     */
+    Real width = 1;
+
+    /**
+     * @brief Terms of the basis, cf. addTerms().
+     *
+     */
+    std::vector<Term> terms;
+
+    /**
+     * @brief Overlaps, for all of them the results are fitted.
+     *
+     */
+    std::vector<Real> ovls;
+
+    /**
+     * @brief Number of results per overlap, in the format of write().
+     *
+     */
+    size_t entries = 0;
+
+    /**
+     * @brief Coefficients, the ones of term t are coef[t*outs(), (t+1)*outs()). Fidelities are stored as probability times fidelity.
+     *
+     */
+    std::vector<double> coef;
+
+    /**
+     * @brief Largest absolute residual of the fit at the samples, cf. fit().
+     *
+     */
+    double resid = 0;
+
+    /**
+     * @brief Adds all terms with the entries of t and further errors from first on with total degree at most left.
+     *
+     * @param t Term that is extended
+     * @param first First error that may be added
+     * @param left Remaining degree
+     */
+    void addTerms(Term& t, int first, int left){
+        terms.push_back(t);
+        for (int i = first; i<dims; i++)
+            for (int k = 1; k<=left; k++){
+                t.push_back(std::make_pair(i, k));
+                addTerms(t, i+1, left-k);
+                t.pop_back();
+            }
+    }
+
+    /**
+     * @brief Number of fitted values, one per overlap and result.
+     *
+     * @return size_t Number of values
+     */
+    size_t outs() const {return ovls.size()*entries;}
+
+    /**
+     * @brief Values of the basis for one point.
+     *
+     * @param errs Rotation errors
+     * @param b Output: one value per term
+     */
+    void basis(const std::vector<Real>& errs, double* b) const {
+        std::vector<double> T(dims*(deg+1));
+        double x;
+        for (int i = 0; i<dims; i++){
+            x = errs[i]/(double) width;
+            T[i*(deg+1)] = 1;
+            if (deg > 0) T[i*(deg+1)+1] = x;
+            for (int k = 2; k<=deg; k++)
+                T[i*(deg+1)+k] = 2*x*T[i*(deg+1)+k-1]-T[i*(deg+1)+k-2];
+        }
+        for (size_t t = 0; t<terms.size(); t++){
+            b[t] = 1;
+            for (const std::pair<int, int>& e : terms[t])
+                b[t] *= T[e.first*(deg+1)+e.second];
+        }
+    }
+
+    /**
+     * @brief Solves A X = Y for a symmetric positive definite A by Cholesky decomposition. Directions without positive pivot are set to 0, cf. gsMatrix().
+     *
+     * @param A n x n matrix, overwritten by its decomposition
+     * @param Y n x m right-hand sides, overwritten by the solution
+     * @param n Number of rows of A
+     * @param m Number of right-hand sides
+     */
+    static void solve(std::vector<double>& A, std::vector<double>& Y, size_t n, size_t m){
+        double v;
+        for (size_t j = 0; j<n; j++){
+            for (size_t i = j; i<n; i++){
+                v = A[i*n+j];
+                for (size_t k = 0; k<j; k++)
+                    v -= A[i*n+k]*A[j*n+k];
+                if (i == j) A[j*n+j] = (v > 0) ? std::sqrt(v) : 0.0;
+                else A[i*n+j] = (A[j*n+j] > 0) ? v/A[j*n+j] : 0.0;
+            }
+        }
+        for (size_t i = 0; i<n; i++){ //L Z = Y
+            for (size_t k = 0; k<i; k++)
+                axpy(Y.data()+i*m, Y.data()+k*m, m, -A[i*n+k]);
+            if (A[i*n+i] > 0) scale(Y.data()+i*m, m, 1/A[i*n+i]);
+            else std::fill(Y.begin()+i*m, Y.begin()+(i+1)*m, 0.0);
+        }
+        for (size_t i = n; i-- > 0;){ //L^T X = Z
+            for (size_t k = i+1; k<n; k++)
+                axpy(Y.data()+i*m, Y.data()+k*m, m, -A[k*n+i]);
+            if (A[i*n+i] > 0) scale(Y.data()+i*m, m, 1/A[i*n+i]);
+            else std::fill(Y.begin()+i*m, Y.begin()+(i+1)*m, 0.0);
+        }
+    }
+
+    public:
+
+        /**
+         * @brief Construct a new FidCheb object.
+         *
+         * @param d Maximal total degree of the terms
+         * @param w Half width of the box of the errors, in degree
+         */
+        FidCheb(int d = 2, Real w = 1){
+            deg = d;
+            width = w;
+            Term t;
+            addTerms(t, 0, deg);
+        }
+
+        /**
+         * @brief Number of terms of the basis.
+         *
+         * @return size_t Number of terms
+         */
+        size_t size() const {return terms.size();}
+
+        /**
+         * @brief Half width of the box of the errors.
+         *
+         * @return Real Half width
+         */
+        Real halfWidth() const {return width;}
+
+        /**
+         * @brief Largest absolute residual of the fit at the samples, for the probabilities and the probabilities of the GHZ state.
+         *
+         * @return double Residual
+         */
+        double residual() const {return resid;}
+
+        /**
+         * @brief Sample points of the errors for the fit, distributed by the Chebyshev density on the box, which keeps the least-squares fit well-conditioned.
+         *
+         * @tparam Gen Random number generator, e.g. std::mt19937
+         * @param n Number of points
+         * @param gen Random number generator
+         * @return std::vector<std::vector<Real>> n points with 15 errors each
+         */
+        template<class Gen>
+        std::vector<std::vector<Real>> samples(size_t n, Gen& gen) const {
+            std::uniform_real_distribution<double> u(0.0, 1.0);
+            std::vector<std::vector<Real>> errs(n, std::vector<Real>(dims));
+            for (std::vector<Real>& e : errs)
+                for (Real& x : e)
+                    x = (Real) (width*std::cos(numbers::pi*u(gen)));
+            return errs;
+        }
+
+        /**
+         * @brief Fits the coefficients to results at sample points by least squares.
+         *
+         * @param o Overlaps of the results
+         * @param errs Sample points, 15 errors each, at least size() of them
+         * @param res For every sample point and overlap the results in the format of write(), i.e. probability and fidelity alternating
+         */
+        void fit(const std::vector<Real>& o, const std::vector<std::vector<Real>>& errs, const std::vector<std::vector<std::vector<Real>>>& res){
+            ovls = o;
+            entries = res[0][0].size();
+            size_t n = terms.size(), m = outs();
+            std::vector<double> A(n*n, 0.0), b(n), y(m);
+            coef.assign(n*m, 0.0);
+            for (size_t s = 0; s<errs.size(); s++){
+                basis(errs[s], b.data());
+                for (size_t i = 0; i<n; i++)
+                    axpy(A.data()+i*n, b.data(), n, b[i]);
+                for (size_t j = 0; j<ovls.size(); j++)
+                    for (size_t e = 0; e<entries; e++)
+                        y[j*entries+e] = (e%2) ? (double) res[s][j][e-1]*res[s][j][e] : (double) res[s][j][e];
+                for (size_t i = 0; i<n; i++)
+                    axpy(coef.data()+i*m, y.data(), m, b[i]);
+            }
+            solve(A, coef, n, m);
+            resid = 0;
+            for (size_t s = 0; s<errs.size(); s++){
+                std::vector<std::vector<Real>> r = eval(errs[s]);
+                for (size_t j = 0; j<ovls.size(); j++)
+                    for (size_t e = 0; e<entries; e+=2){
+                        resid = std::max(resid, std::abs((double) r[j][e]-res[s][j][e]));
+                        resid = std::max(resid, std::abs((double) r[j][e]*r[j][e+1]-(double) res[s][j][e]*res[s][j][e+1]));
+                    }
+            }
+        }
+
+        /**
+         * @brief Evaluates the surrogate for one point.
+         *
+         * @param errs Rotation errors
+         * @return std::vector<std::vector<Real>> For every overlap the results in the format of write()
+         */
+        std::vector<std::vector<Real>> eval(const std::vector<Real>& errs) const {
+            return eval(std::vector<std::vector<Real>>{errs})[0];
+        }
+
+        /**
+         * @brief Evaluates the surrogate for a batch of points.
+         *
+         * @param errs Rotation errors, 15 per point
+         * @return std::vector<std::vector<std::vector<Real>>> For every point and overlap the results in the format of write()
+         */
+        std::vector<std::vector<std::vector<Real>>> eval(const std::vector<std::vector<Real>>& errs) const {
+            size_t n = terms.size(), m = outs();
+            std::vector<std::vector<std::vector<Real>>> res(errs.size(), std::vector<std::vector<Real>>(ovls.size(), std::vector<Real>(entries)));
+            KERNEL_PARALLEL_FOR(errs.size())
+            for (size_t q = 0; q<errs.size(); q++){
+                std::vector<double> b(n), y(m, 0.0);
+                basis(errs[q], b.data());
+                for (size_t t = 0; t<n; t++)
+                    axpy(y.data(), coef.data()+t*m, m, b[t]);
+                for (size_t j = 0; j<ovls.size(); j++)
+                    for (size_t e = 0; e<entries; e+=2){
+                        res[q][j][e] = (Real) y[j*entries+e];
+                        res[q][j][e+1] = (Real) (y[j*entries+e+1]/y[j*entries+e]);
+                    }
+            }
+            return res;
+        }
+
+        /**
+         * @brief Overlaps of the results.
+         *
+         * @return const std::vector<Real>& Overlaps
+         */
+        const std::vector<Real>& overlaps() const {return ovls;}
+
+        /**
+         * @brief Writes the surrogate to a stream.
+         *
+         * @param os Stream
+         */
+        void save(std::ostream& os) const {
+            os << deg << " " << std::setprecision(12) << width << " " << entries << " " << resid << "\n";
+            os << ovls.size();
+            for (Real o : ovls) os << " " << o;
+            os << "\n";
+            for (size_t t = 0; t<terms.size(); t++){
+                for (size_t j = 0; j<outs(); j++)
+                    os << std::setprecision(17) << coef[t*outs()+j] << " ";
+                os << "\n";
+            }
+        }
+
+        /**
+         * @brief Reads a surrogate written by save().
+         *
+         * @param is Stream
+         */
+        void load(std::istream& is){
+            size_t n;
+            is >> deg >> width >> entries >> resid >> n;
+            ovls.assign(n, 0);
+            for (Real& o : ovls) is >> o;
+            terms.clear();
+            Term t;
+            addTerms(t, 0, deg);
+            coef.assign(terms.size()*outs(), 0.0);
+            for (double& c : coef) is >> c;
+        }
+};
+
+#endif
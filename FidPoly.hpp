@@ -0,0 +1,385 @@
+/**
+ * @file FidPoly.hpp
+ * @author Fabian Wiesner (fabian.wiesner97@gmail.com)
+ * @brief Defines the class FidPoly, an overlap-independent representation of the fidelity of one scenario.
+ * @version 0.1
+ * @date 2024-06-06
+ *
+ * @copyright Copyright (c) 2024, provided under CC BY-NC 4.0. license
+ *
+ */
+
+ /*
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef FIDPOLY_HPP
+#define FIDPOLY_HPP
+#include "State.hpp"
+#include "Key.hpp"
+#include "simAux.hpp"
+#include <iomanip>
+#include <cassert>
+
+/**
+ * @brief Overlap-independent representation of the probabilities and fidelities of one scenario.
+ *
+ * The amplitude of an input combination of DModes in the reference state of fid() is a monomial in the closed-form Gram-Schmidt coefficients gsCoeff().
+ * Input combinations with the same monomial (signature) are merged into one column. For every measurement outcome the accepted states and the states
+ * projected onto the GHZ state are stored as sparse matrices, such that probability and fidelity for an overlap are squared norms of matrix-vector products
+ * with the amplitudes amps().
+ *
+ * @tparam Real Real number type that should be used, e.g. float. The amplitudes of the States are Real as well.
+ * @tparam K Key-type, cf. State
+ */
+template<class Real, class K = Key<int>>
+class FidPoly{
+    /**
+     * @brief Signature of a column: Entry n<6 is 1, if photon n is in its own orthogonal DMode, entry 6+k is the number of photons in the orthogonal DMode k<n.
+     * If perConf is set, entry n<6 is the orthogonal DMode of photon n instead.
+     *
+     */
+    using Sig = std::array<int, 12>;
+
+    /**
+     * @brief Sparse row, {column : value}.
+     *
+     */
+    using Row = std::vector<std::pair<int, Real>>;
+
+    /**
+     * @brief Signatures of the columns.
+     *
+     */
+    std::vector<Sig> sigs;
+
+    /**
+     * @brief If set, every input combination of DModes has its own column, which is needed for general overlap matrices.
+     *
+     */
+    bool perConf = false;
+
+    /**
+     * @brief Maps the signatures to the columns, only used while adding.
+     *
+     */
+    boost::container::flat_map<Sig, int> cols;
+
+    /**
+     * @brief Rows of the states projected onto the GHZ state, one matrix per measurement outcome.
+     *
+     */
+    std::array<std::vector<Row>, 8> P;
+
+    /**
+     * @brief Rows of the accepted states, one matrix per measurement outcome.
+     *
+     */
+    std::array<std::vector<Row>, 8> Q;
+
+    /**
+     * @brief Maps the keys to the rows of P, only used while adding.
+     *
+     */
+    std::array<boost::container::flat_map<K, int>, 8> PRows;
+
+    /**
+     * @brief Maps the keys to the rows of Q, only used while adding.
+     *
+     */
+    std::array<boost::container::flat_map<K, int>, 8> QRows;
+
+    /**
+     * @brief Adds a scaled state to a matrix.
+     *
+     * @param S State to add
+     * @param c Column of S
+     * @param M Matrix
+     * @param rows Maps the keys to the rows of M
+     */
+    void addTo(const State<K, Real, Real>& S, int c, std::vector<Row>& M, boost::container::flat_map<K, int>& rows){
+        std::pair<typename boost::container::flat_map<K, int>::iterator, bool> pib;
+        typename Row::iterator rit;
+        for (typename State<K, Real, Real>::const_iterator it = S.cbegin(); it != S.cend(); it++){
+            pib = rows.emplace(it->first, M.size());
+            if (pib.second)
+                M.push_back({});
+            Row& r = M[pib.first->second];
+            rit = std::find_if(r.begin(), r.end(), [c](const std::pair<int, Real>& e){return e.first == c;});
+            if (rit == r.end())
+                r.push_back(std::make_pair(c, it->second));
+            else
+                rit->second += it->second;
+        }
+    }
+
+    /**
+     * @brief Squared norm of M*a.
+     *
+     * @param M Matrix
+     * @param a Amplitudes of the columns
+     * @return accum_t<Real> The squared norm, accumulated in higher precision (cf. Accum)
+     */
+    static accum_t<Real> normSq(const std::vector<Row>& M, const std::vector<Real>& a){
+        accum_t<Real> n = 0, v;
+        for (const Row& r : M){
+            v = 0;
+            for (const std::pair<int, Real>& e : r)
+                v += ((accum_t<Real>) e.second)*a[e.first];
+            n += v*v;
+        }
+        return n;
+    }
+
+    /**
+     * @brief Squared norms of M*a for several lanes of amplitudes.
+     *
+     * @param M Matrix
+     * @param a Amplitudes of the columns, the lanes of column c are a[c*lanes, (c+1)*lanes)
+     * @param lanes Number of lanes
+     * @return std::vector<accum_t<Real>> One squared norm per lane, accumulated in higher precision
+     */
+    static std::vector<accum_t<Real>> normSq(const std::vector<Row>& M, const std::vector<Real>& a, size_t lanes){
+        std::vector<accum_t<Real>> n(lanes, 0.0), v(lanes);
+        const Real* src;
+        for (const Row& r : M){
+            std::fill(v.begin(), v.end(), (accum_t<Real>) 0.0);
+            for (const std::pair<int, Real>& e : r){
+                src = a.data()+e.first*lanes;
+                axpy(v.data(), src, lanes, e.second);
+            }
+            addSq(n.data(), v.data(), lanes);
+        }
+        return n;
+    }
+
+    /**
+     * @brief Writes a matrix to a stream.
+     *
+     * @param os Stream
+     * @param M Matrix
+     */
+    static void saveM(std::ostream& os, const std::vector<Row>& M){
+        os << M.size() << "\n";
+        for (const Row& r : M){
+            os << r.size();
+            for (const std::pair<int, Real>& e : r)
+                os << " " << e.first << " " << std::setprecision(12) << e.second;
+            os << "\n";
+        }
+    }
+
+    /**
+     * @brief Reads a matrix from a stream.
+     *
+     * @param is Stream
+     * @param M Matrix
+     */
+    static void loadM(std::istream& is, std::vector<Row>& M){
+        size_t n, m;
+        is >> n;
+        M.assign(n, {});
+        for (Row& r : M){
+            is >> m;
+            r.resize(m);
+            for (std::pair<int, Real>& e : r)
+                is >> e.first >> e.second;
+        }
+    }
+
+    /**
+     * @brief Checks whether all pairwise overlaps are equal.
+     *
+     * @param G Matrix of pairwise overlaps
+     * @return bool Whether G is uniform
+     */
+    static bool uniform(const std::vector<std::vector<Real>>& G){
+        for (size_t i = 0; i<G.size(); i++)
+            for (size_t j = 0; j<G[i].size(); j++)
+                if (i != j && G[i][j] != G[0][1]) return false;
+        return true;
+    }
+
+    public:
+
+        /**
+         * @brief Construct a new FidPoly object.
+         *
+         * @param pc If set, input combinations of DModes are not merged, cf. perConf.
+         */
+        explicit FidPoly(bool pc = false){perConf = pc;}
+
+        /**
+         * @brief Adds an input combination of DModes.
+         *
+         * @param conf Key that encodes the input combination of DModes, cf. fidsim(). Photon n is in the S&P mode 2n.
+         * @param Proj States after the measurement projected onto the GHZ state, cf. fidProject()
+         * @param PreData Remaining states after the measurement
+         * @param Compl Complement of the states after the measurement
+         */
+        void add(const K& conf, const std::array<State<K, Real, Real>, 8>& Proj, const std::array<State<K, Real, Real>, 8>& PreData, const std::array<State<K, Real, Real>, 8>& Compl){
+            Sig s = {};
+            int n, d;
+            for (typename K::const_iterator it = conf.cbegin(); it != conf.cend(); it++){
+                n = it->first.first/2;
+                d = it->first.second;
+                if (perConf) s[n] = d;
+                else if (d == n) s[n] = 1;
+                else s[6+d] += 1;
+            }
+            std::pair<typename boost::container::flat_map<Sig, int>::iterator, bool> pib = cols.emplace(s, sigs.size());
+            if (pib.second)
+                sigs.push_back(s);
+            int c = pib.first->second;
+            for (int j = 0; j<8; j++){
+                addTo(Proj[j], c, P[j], PRows[j]);
+                addTo(PreData[j], c, Q[j], QRows[j]);
+                addTo(Compl[j], c, Q[j], QRows[j]);
+            }
+        }
+
+        /**
+         * @brief Amplitudes of the columns for the pairwise overlap ovl.
+         *
+         * @param ovl Pairwise overlap
+         * @return std::vector<Real> One amplitude per column
+         */
+        std::vector<Real> amps(const Real& ovl) const {
+            std::vector<Real> a;
+            Real v;
+            for (const Sig& s : sigs){
+                v = 1.0;
+                for (int n = 0; n<6; n++){
+                    if (perConf) v *= gsCoeff<Real>(n, s[n], ovl);
+                    else {
+                        if (s[n]) v *= gsCoeff<Real>(n, n, ovl);
+                        if (s[6+n]) v *= std::pow(gsCoeff<Real>(n+1, n, ovl), s[6+n]);
+                    }
+                }
+                a.push_back(v);
+            }
+            return a;
+        }
+
+        /**
+         * @brief Amplitudes of the columns for a matrix of pairwise overlaps. Without perConf the columns are merged for a uniform overlap, such
+         * that G has to be uniform.
+         *
+         * @param G 6x6 matrix of pairwise overlaps, cf. gsMatrix()
+         * @return std::vector<Real> One amplitude per column
+         */
+        std::vector<Real> amps(const std::vector<std::vector<Real>>& G) const {
+            assert(perConf || uniform(G));
+            std::vector<std::vector<Real>> L = gsMatrix(G);
+            std::vector<Real> a;
+            Real v;
+            for (const Sig& s : sigs){
+                v = 1.0;
+                for (int n = 0; n<6; n++){
+                    if (perConf) v *= L[n][s[n]];
+                    else {
+                        if (s[n]) v *= L[n][n];
+                        if (s[6+n]) v *= std::pow(L[n+1][n], s[6+n]);
+                    }
+                }
+                a.push_back(v);
+            }
+            return a;
+        }
+
+        /**
+         * @brief Evaluates the probabilities and fidelities for the pairwise overlap ovl.
+         *
+         * @param ovl Pairwise overlap
+         * @return std::vector<Real> Probability and fidelity for every measurement outcome, same format as in fid()
+         */
+        std::vector<Real> eval(const Real& ovl) const {
+            std::vector<Real> a = amps(ovl), res;
+            accum_t<Real> p;
+            for (int j = 0; j<8; j++){
+                p = normSq(Q[j], a);
+                res.push_back(p);
+                res.push_back(normSq(P[j], a)/p);
+            }
+            return res;
+        }
+
+        /**
+         * @brief Evaluates the probabilities and fidelities for a batch of overlap matrices in one pass over the stored matrices.
+         *
+         * @param Gs 6x6 matrices of pairwise overlaps
+         * @return std::vector<std::vector<Real>> Probability and fidelity for every measurement outcome, one vector per matrix
+         */
+        std::vector<std::vector<Real>> eval(const std::vector<std::vector<std::vector<Real>>>& Gs) const {
+            size_t lanes = Gs.size();
+            std::vector<Real> a(sigs.size()*lanes), ag;
+            for (size_t l = 0; l<lanes; l++){
+                ag = amps(Gs[l]);
+                for (size_t c = 0; c<ag.size(); c++)
+                    a[c*lanes+l] = ag[c];
+            }
+            std::vector<std::vector<Real>> res(lanes);
+            std::vector<accum_t<Real>> p, f;
+            for (int j = 0; j<8; j++){
+                p = normSq(Q[j], a, lanes);
+                f = normSq(P[j], a, lanes);
+                for (size_t l = 0; l<lanes; l++){
+                    res[l].push_back(p[l]);
+                    res[l].push_back(f[l]/p[l]);
+                }
+            }
+            return res;
+        }
+
+        /**
+         * @brief Number of columns, i.e. different signatures.
+         *
+         * @return size_t Number of columns
+         */
+        size_t size() const {return sigs.size();}
+
+        /**
+         * @brief Writes the representation to a stream.
+         *
+         * @param os Stream
+         */
+        void save(std::ostream& os) const {
+            os << sigs.size() << " " << perConf << "\n";
+            for (const Sig& s : sigs){
+                for (int i : s) os << i << " ";
+                os << "\n";
+            }
+            for (int j = 0; j<8; j++){
+                saveM(os, P[j]);
+                saveM(os, Q[j]);
+            }
+        }
+
+        /**
+         * @brief Reads a representation written by save(). Afterwards, no further input combinations can be added.
+         *
+         * @param is Stream
+         */
+        void load(std::istream& is){
+            size_t n;
+            is >> n >> perConf;
+            sigs.assign(n, {});
+            for (Sig& s : sigs)
+                for (int& i : s) is >> i;
+            for (int j = 0; j<8; j++){
+                loadM(is, P[j]);
+                loadM(is, Q[j]);
+                PRows[j].clear();
+                QRows[j].clear();
+            }
+            cols.clear();
+        }
+};
+
+#endif
@@ -0,0 +1,398 @@
+/**
+ * @file Half.hpp
+ * @author Fabian Wiesner (fabian.wiesner97@gmail.com)
+ * @brief 16-bit floating point amplitude types (IEEE binary16 and bfloat16) for reduced-precision storage. Arithmetic is done in float.
+ * @version 0.1
+ * @date 2024-06-06
+ *
+ * @copyright Copyright (c) 2024, provided under CC BY-NC 4.0. license
+ *
+ */
+
+ /*
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef HALF_HPP
+#define HALF_HPP
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include "Kernels.hpp"
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+/*
+Float16 only stores the bits, every operation converts to float, computes in float and rounds back to 16 bit when the result is stored.
+Half (IEEE binary16) keeps 11 significant bits but only covers magnitudes from about 6e-8 (subnormal) to 65504, smaller amplitudes are flushed to 0.
+BF16 (bfloat16) has the range of float and 8 significant bits. The array conversions widen() and narrow() use F16C for Half if the CPU supports it,
+the conversions of single numbers if compiled with -mf16c.
+The kernels for Float16 arrays convert blocks of KERNEL_BLOCK amplitudes to float and call the float kernels, sums are accumulated in double, cf. Accum.
+*/
+
+/**
+ * @brief Bit conversions of IEEE binary16, rounding to nearest even.
+ *
+ */
+struct FmtHalf{
+    /**
+     * @brief Converts binary16 bits to a float.
+     *
+     * @param h Bits
+     * @return float Value
+     */
+    static inline float toFloat(uint16_t h){
+#if defined(__F16C__)
+        return _cvtsh_ss(h);
+#else
+        uint32_t sign = ((uint32_t) (h & 0x8000)) << 16, e = (h >> 10) & 0x1F, m = h & 0x3FF, u;
+        if (e == 0){
+            if (m == 0)
+                u = sign;
+            else { //subnormal, normalized in float
+                e = 113;
+                while (!(m & 0x400)){m <<= 1; e--;}
+                u = sign | (e << 23) | ((m & 0x3FF) << 13);
+            }
+        }
+        else if (e == 31)
+            u = sign | 0x7F800000 | (m << 13);
+        else
+            u = sign | ((e+112) << 23) | (m << 13);
+        float f;
+        std::memcpy(&f, &u, 4);
+        return f;
+#endif
+    }
+
+    /**
+     * @brief Converts a float to binary16 bits. Overflows become infinity, magnitudes below the smallest subnormal become 0.
+     *
+     * @param f Value
+     * @return uint16_t Bits
+     */
+    static inline uint16_t fromFloat(float f){
+#if defined(__F16C__)
+        return _cvtss_sh(f, _MM_FROUND_TO_NEAREST_INT);
+#else
+        uint32_t u, a, r, rem, half, shift;
+        std::memcpy(&u, &f, 4);
+        uint16_t sign = (u >> 16) & 0x8000;
+        a = u & 0x7FFFFFFF;
+        if (a > 0x7F800000) return sign | 0x7E00;
+        if (a >= 0x47800000) return sign | 0x7C00;
+        if (a < 0x38800000){ //subnormal in binary16, units of 2^-24
+            if (a < 0x33000000) return sign;
+            shift = 126-(a >> 23);
+            a = (a & 0x7FFFFF) | 0x800000;
+            r = a >> shift;
+            rem = a & ((1u << shift)-1);
+            half = 1u << (shift-1);
+            if (rem > half || (rem == half && (r & 1))) r++;
+            return sign | r;
+        }
+        r = (a-0x38000000) >> 13;
+        rem = a & 0x1FFF;
+        if (rem > 0x1000 || (rem == 0x1000 && (r & 1))) r++; //may round up to infinity
+        return sign | r;
+#endif
+    }
+};
+
+/**
+ * @brief Bit conversions of bfloat16, i.e. the upper half of a float, rounding to nearest even.
+ *
+ */
+struct FmtBF16{
+    /**
+     * @brief Converts bfloat16 bits to a float.
+     *
+     * @param h Bits
+     * @return float Value
+     */
+    static inline float toFloat(uint16_t h){
+        uint32_t u = ((uint32_t) h) << 16;
+        float f;
+        std::memcpy(&f, &u, 4);
+        return f;
+    }
+
+    /**
+     * @brief Converts a float to bfloat16 bits.
+     *
+     * @param f Value
+     * @return uint16_t Bits
+     */
+    static inline uint16_t fromFloat(float f){
+        uint32_t u;
+        std::memcpy(&u, &f, 4);
+        if ((u & 0x7FFFFFFF) > 0x7F800000) return (u >> 16) | 0x40; //quiet NaN
+        return (u+0x7FFF+((u >> 16) & 1)) >> 16;
+    }
+};
+
+/**
+ * @brief 16-bit floating point number. Converts implicitly from and to float, such that it can be used as amplitude type of State and BlockState.
+ *
+ * @tparam Fmt Format, FmtHalf or FmtBF16
+ */
+template<class Fmt>
+class Float16{
+    /**
+     * @brief Bits of the number.
+     *
+     */
+    uint16_t bits = 0;
+
+    public:
+
+        /**
+         * @brief Construct a new Float16 object with value 0.
+         *
+         */
+        Float16(){}
+
+        /**
+         * @brief Construct a new Float16 object from a real number, rounded to nearest.
+         *
+         * @tparam T Arithmetic type
+         * @param v Value
+         */
+        template<class T, class = typename std::enable_if<std::is_arithmetic<T>::value>::type>
+        Float16(T v){bits = Fmt::fromFloat((float) v);}
+
+        /**
+         * @brief Converts to float, which is exact.
+         *
+         * @return float Value
+         */
+        inline operator float() const {return Fmt::toFloat(bits);}
+
+        /**
+         * @brief Raw bits, cf. Fmt.
+         *
+         * @return uint16_t Bits
+         */
+        inline uint16_t raw() const {return bits;}
+
+        /**
+         * @brief Adds a value in float and rounds the result.
+         *
+         * @param v Value
+         * @return Float16& This
+         */
+        inline Float16& operator+=(float v){*this = (float) *this+v; return *this;}
+
+        /**
+         * @brief Subtracts a value in float and rounds the result.
+         *
+         * @param v Value
+         * @return Float16& This
+         */
+        inline Float16& operator-=(float v){*this = (float) *this-v; return *this;}
+
+        /**
+         * @brief Multiplies with a value in float and rounds the result.
+         *
+         * @param v Value
+         * @return Float16& This
+         */
+        inline Float16& operator*=(float v){*this = (float) *this*v; return *this;}
+
+        /**
+         * @brief Divides by a value in float and rounds the result.
+         *
+         * @param v Value
+         * @return Float16& This
+         */
+        inline Float16& operator/=(float v){*this = (float) *this/v; return *this;}
+};
+
+/**
+ * @brief IEEE binary16 amplitudes.
+ *
+ */
+using Half = Float16<FmtHalf>;
+
+/**
+ * @brief bfloat16 amplitudes.
+ *
+ */
+using BF16 = Float16<FmtBF16>;
+
+/**
+ * @brief Sums of 16-bit numbers are computed in float and accumulated in double, cf. Accum.
+ *
+ * @tparam Fmt Format, cf. Float16
+ */
+template<class Fmt>
+struct Accum<Float16<Fmt>>{using type = double;};
+
+/**
+ * @brief Squared absolute value, computed in float, cf. absSq().
+ *
+ * @tparam Fmt Format, cf. Float16
+ * @param v Number
+ * @return float v^2
+ */
+template<class Fmt>
+inline float absSq(const Float16<Fmt>& v){
+    float f = v;
+    return f*f;
+}
+
+/**
+ * @brief Converts an array of 16-bit numbers to float.
+ *
+ * @tparam Fmt Format, cf. Float16
+ * @param a Numbers
+ * @param n Number of numbers
+ * @param f Output: values, n floats
+ */
+template<class Fmt>
+inline void widen(const Float16<Fmt>* a, size_t n, float* f){
+    for (size_t i = 0; i<n; i++)
+        f[i] = a[i];
+}
+
+/**
+ * @brief Rounds an array of floats to 16-bit numbers.
+ *
+ * @tparam Fmt Format, cf. Float16
+ * @param f Values
+ * @param n Number of values
+ * @param a Output: numbers, n values
+ */
+template<class Fmt>
+inline void narrow(const float* f, size_t n, Float16<Fmt>* a){
+    for (size_t i = 0; i<n; i++)
+        a[i] = f[i];
+}
+
+#if defined(KERNEL_DISPATCH)
+/**
+ * @brief Converts an array of binary16 numbers to float with F16C, cf. widen().
+ *
+ * @param a Numbers
+ * @param n Number of numbers
+ * @param f Output: values, n floats
+ */
+__attribute__((target("avx,f16c"))) inline void widenF16C(const Half* a, size_t n, float* f){
+    size_t i = 0;
+    const uint16_t* h = reinterpret_cast<const uint16_t*>(a);
+    for (; i+8<=n; i+=8)
+        _mm256_storeu_ps(f+i, _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(h+i))));
+    for (; i<n; i++)
+        f[i] = a[i];
+}
+
+/**
+ * @brief Rounds an array of floats to binary16 with F16C, cf. narrow().
+ *
+ * @param f Values
+ * @param n Number of values
+ * @param a Output: numbers, n values
+ */
+__attribute__((target("avx,f16c"))) inline void narrowF16C(const float* f, size_t n, Half* a){
+    size_t i = 0;
+    uint16_t* h = reinterpret_cast<uint16_t*>(a);
+    for (; i+8<=n; i+=8)
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(h+i), _mm256_cvtps_ph(_mm256_loadu_ps(f+i), _MM_FROUND_TO_NEAREST_INT));
+    for (; i<n; i++)
+        a[i] = f[i];
+}
+
+/**
+ * @brief Converts an array of binary16 numbers to float, with F16C if the CPU supports it (cf. kernels()).
+ *
+ * @param a Numbers
+ * @param n Number of numbers
+ * @param f Output: values, n floats
+ */
+inline void widen(const Half* a, size_t n, float* f){
+    if (kernels().f16c) widenF16C(a, n, f);
+    else for (size_t i = 0; i<n; i++) f[i] = a[i];
+}
+
+/**
+ * @brief Rounds an array of floats to binary16, with F16C if the CPU supports it (cf. kernels()).
+ *
+ * @param f Values
+ * @param n Number of values
+ * @param a Output: numbers, n values
+ */
+inline void narrow(const float* f, size_t n, Half* a){
+    if (kernels().f16c) narrowF16C(f, n, a);
+    else for (size_t i = 0; i<n; i++) a[i] = f[i];
+}
+#endif
+
+/**
+ * @brief Squared norm of a 16-bit array, cf. sqNorm(). Equal to the squared norm of the widened float array.
+ *
+ * @tparam Fmt Format, cf. Float16
+ * @param a Amplitudes
+ * @param n Number of amplitudes
+ * @return double Squared norm
+ */
+template<class Fmt>
+inline double sqNorm(const Float16<Fmt>* a, size_t n){
+    float f[KERNEL_BLOCK];
+    double r = 0;
+    size_t m;
+    for (size_t i = 0; i<n; i+=KERNEL_BLOCK){
+        m = std::min(KERNEL_BLOCK, n-i);
+        widen(a+i, m, f);
+        r += sqNorm(f, m);
+    }
+    return r;
+}
+
+/**
+ * @brief Scales a 16-bit array in float, cf. scale().
+ *
+ * @tparam Fmt Format, cf. Float16
+ * @param a Amplitudes
+ * @param n Number of amplitudes
+ * @param s Scalar
+ */
+template<class Fmt>
+inline void scale(Float16<Fmt>* a, size_t n, float s){
+    float f[KERNEL_BLOCK];
+    size_t m;
+    for (size_t i = 0; i<n; i+=KERNEL_BLOCK){
+        m = std::min(KERNEL_BLOCK, n-i);
+        widen(a+i, m, f);
+        scale(f, m, s);
+        narrow(f, m, a+i);
+    }
+}
+
+/**
+ * @brief Scaled addition of 16-bit amplitudes to a double accumulator, y += s*x, cf. axpy().
+ *
+ * @tparam Fmt Format, cf. Float16
+ * @param y Accumulator
+ * @param x Amplitudes that are added
+ * @param n Number of amplitudes
+ * @param s Scalar
+ */
+template<class Fmt>
+inline void axpy(double* y, const Float16<Fmt>* x, size_t n, double s){
+    float f[KERNEL_BLOCK];
+    size_t m;
+    for (size_t i = 0; i<n; i+=KERNEL_BLOCK){
+        m = std::min(KERNEL_BLOCK, n-i);
+        widen(x+i, m, f);
+        axpy(y+i, f, m, s);
+    }
+}
+
+#endif
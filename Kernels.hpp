@@ -0,0 +1,863 @@
+/**
+ * @file Kernels.hpp
+ * @author Fabian Wiesner (fabian.wiesner97@gmail.com)
+ * @brief Vectorized kernels for contiguous amplitude arrays: squared norm, scaling, axpy and elementwise squares, and the hardware check for the 16-bit widen/narrow conversions of Half.hpp.
+ * @version 0.1
+ * @date 2024-06-06
+ *
+ * @copyright Copyright (c) 2024, provided under CC BY-NC 4.0. license
+ *
+ */
+
+ /*
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef KERNELS_HPP
+#define KERNELS_HPP
+#include <vector>
+#include <math.h>
+#include <complex>
+#include <cstddef>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define KERNEL_DISPATCH
+#include <immintrin.h>
+#endif
+#if defined(__GNUC__) && !defined(__clang__) //AVX-512 and -march builds imply FMA, the contraction to fused multiply-add would round differently in the variants
+#define KERNEL_SCALAR __attribute__((optimize("fp-contract=off")))
+#define KERNEL_AVX2 __attribute__((target("avx2"), optimize("fp-contract=off")))
+#define KERNEL_AVX512 __attribute__((target("avx512f"), optimize("fp-contract=off")))
+#else
+#define KERNEL_SCALAR
+#define KERNEL_AVX2 __attribute__((target("avx2")))
+#define KERNEL_AVX512 __attribute__((target("avx512f")))
+#endif
+
+/*
+The float kernels are compiled for AVX-512, AVX2 and without vector instructions in the same binary, the variant is selected at runtime
+by CPUID, cf. kernels(). Complex amplitudes are processed interleaved (std::complex<float>). All variants round the same, such that the results
+do not depend on the CPU. Other types use the generic templates.
+Sums of floats are returned and accumulated in double, cf. Accum.
+*/
+
+/**
+ * @brief Number of partial sums used by sqNorm().
+ *
+ */
+const size_t KERNEL_LANES = 16;
+
+/**
+ * @brief Number of amplitudes that sqNorm() sums in float before the partial sums are added to the double total.
+ *
+ */
+const size_t KERNEL_BLOCK = 1024;
+
+/**
+ * @brief Arrays shorter than this are processed by the scalar variants inline, without the indirect call, e.g. the lanes of LaneAcc.
+ *
+ */
+const size_t KERNEL_SHORT = 32;
+
+/**
+ * @brief Number of entries per chunk of the State-level reductions, cf. pairwiseReduce(). The chunk boundaries only depend on the number of entries,
+ * such that the results do not depend on the number of threads.
+ *
+ */
+const size_t REDUCE_CHUNK = 4096;
+
+#define KERNEL_STR(x) #x
+#if defined(_OPENMP) //the loop over n chunks only starts threads if there are at least 2 chunks
+#define KERNEL_PARALLEL_FOR(n) _Pragma(KERNEL_STR(omp parallel for schedule(dynamic) if((n) > 1)))
+#else
+#define KERNEL_PARALLEL_FOR(n)
+#endif
+
+/**
+ * @brief Type used to accumulate sums of Reals. Amplitudes are stored in float, but norms and sums over many tiny contributions are accumulated in double.
+ *
+ * @tparam Real Real number type
+ */
+template<class Real>
+struct Accum{using type = Real;};
+
+/**
+ * @brief Sums of floats are accumulated in double, cf. Accum.
+ *
+ */
+template<>
+struct Accum<float>{using type = double;};
+
+/**
+ * @brief Complex numbers are accumulated in the accumulation type of their parts, cf. Accum.
+ *
+ * @tparam Real Real number type
+ */
+template<class Real>
+struct Accum<std::complex<Real>>{using type = std::complex<typename Accum<Real>::type>;};
+
+/**
+ * @brief Short handle for the accumulation type of Real, cf. Accum.
+ *
+ * @tparam Real Real number type
+ */
+template<class Real>
+using accum_t = typename Accum<Real>::type;
+
+/**
+ * @brief Squared absolute value without the detour over std::pow.
+ *
+ * @tparam Val Number type
+ * @param v Number
+ * @return auto |v|^2 in the real type of Val
+ */
+template<class Val>
+inline auto absSq(const Val& v){return std::norm(v);}
+
+/**
+ * @brief Weight of an amplitude for the truncation, which is compared to the squared tolerance, i.e. absSq() for numbers. Types with several entries
+ * use their largest absolute entry, cf. Dual.hpp.
+ *
+ * @tparam Val Number type
+ * @param v Number
+ * @return auto Weight in the real type of Val
+ */
+template<class Val>
+inline auto truncWeight(const Val& v){return absSq(v);}
+
+/**
+ * @brief Short handle for the type in which squared norms of Val amplitudes are accumulated, i.e. accum_t of the type of absSq(). This is accum_t<Real> for real,
+ * complex and 16-bit amplitudes, for Dual numbers the squared norm keeps its derivatives.
+ *
+ * @tparam Val Amplitude type
+ */
+template<class Val>
+using sqnorm_t = accum_t<decltype(absSq(std::declval<Val>()))>;
+
+/**
+ * @brief Product of two numbers. For complex numbers the plain formula is used, i.e. without the checks for infinities of operator*, which
+ * are a library call per multiplication unless compiled with -ffast-math.
+ *
+ * @tparam Val Number type
+ * @param a Number
+ * @param b Number
+ * @return Val a*b
+ */
+template<class Val>
+inline Val mulPlain(const Val& a, const Val& b){return a*b;}
+
+/**
+ * @brief Product of two complex numbers, cf. mulPlain().
+ *
+ * @tparam Real Real number type
+ * @param a Number
+ * @param b Number
+ * @return std::complex<Real> a*b
+ */
+template<class Real>
+inline std::complex<Real> mulPlain(const std::complex<Real>& a, const std::complex<Real>& b){
+    return std::complex<Real>(a.real()*b.real()-a.imag()*b.imag(), a.real()*b.imag()+a.imag()*b.real());
+}
+
+/**
+ * @brief Integer power by repeated squaring. Replaces std::pow, which computes complex powers via exp and log.
+ *
+ * @tparam Val Number type
+ * @tparam Int Integer number type
+ * @param x Base
+ * @param n Exponent, n>=0
+ * @return Val x^n
+ */
+template<class Val, class Int>
+inline Val ipow(Val x, Int n){
+    Val r = 1.0;
+    while (n > 0){
+        if (n & 1) r = mulPlain(r, x);
+        n >>= 1;
+        if (n > 0) x = mulPlain(x, x);
+    }
+    return r;
+}
+
+/**
+ * @brief Combines the partial results of fixed chunks in a fixed binary tree, v[i] is combined with v[i+w] for w = 1, 2, 4, ...
+ * The result is in v[0] and is the same for every number of threads that computed the partial results.
+ *
+ * @tparam T Type of the partial results
+ * @tparam F Callable taking (T& a, T& b), that combines b into a
+ * @param v Partial results, one per chunk
+ * @param f Combination
+ */
+template<class T, class F>
+inline void pairwiseReduce(std::vector<T>& v, F f){
+    for (size_t w = 1; w<v.size(); w*=2)
+        for (size_t i = 0; i+w<v.size(); i+=2*w)
+            f(v[i], v[i+w]);
+}
+
+/**
+ * @brief Squared norm of an array, i.e. the sum of the squared absolute values.
+ *
+ * @tparam Val Amplitude type
+ * @param a Amplitudes
+ * @param n Number of amplitudes
+ * @return auto Squared norm in the real type of Val
+ */
+template<class Val>
+inline auto sqNorm(const Val* a, size_t n){
+    accum_t<decltype(absSq(*a))> r = 0;
+    for (size_t i = 0; i<n; i++)
+        r += absSq(a[i]);
+    return r;
+}
+
+/*
+Variants of the float kernels for the instruction sets, selected at runtime by kernels(). All variants round identically: sqNorm() uses
+KERNEL_LANES partial sums combined in a fixed order, the other kernels are elementwise and do not fuse multiplication and addition.
+*/
+
+/**
+ * @brief Combines the partial sums of sqNorm() pairwise, in the same order for all instruction sets, and adds the tail of the block.
+ *
+ * @param p Partial sums, KERNEL_LANES values
+ * @param a Amplitudes
+ * @param i First amplitude of the tail
+ * @param e End of the block
+ * @return float Sum of the block
+ */
+KERNEL_SCALAR inline float sqNormBlockEnd(float* p, const float* a, size_t i, size_t e){
+    for (size_t l = 0; i<e && l<KERNEL_LANES; i++, l++)
+        p[l] += a[i]*a[i];
+    for (size_t w = KERNEL_LANES/2; w>0; w/=2)
+        for (size_t l = 0; l<w; l++)
+            p[l] += p[l+w];
+    return p[0];
+}
+
+/**
+ * @brief Squared norm of a float array without vector instructions, cf. sqNorm().
+ *
+ * @param a Amplitudes
+ * @param n Number of amplitudes
+ * @return double Squared norm
+ */
+KERNEL_SCALAR inline double sqNormScalar(const float* a, size_t n){
+    double r = 0;
+    float p[KERNEL_LANES];
+    size_t i = 0, e;
+    while (i<n){
+        e = std::min(n, i+KERNEL_BLOCK);
+        std::fill(p, p+KERNEL_LANES, 0.0f);
+        for (; i+16<=e; i+=16)
+            for (size_t l = 0; l<KERNEL_LANES; l++)
+                p[l] += a[i+l]*a[i+l];
+        r += sqNormBlockEnd(p, a, i, e);
+        i = e;
+    }
+    return r;
+}
+
+/**
+ * @brief Scales a float array without vector instructions, cf. scale().
+ *
+ * @param a Amplitudes
+ * @param n Number of amplitudes
+ * @param s Scalar
+ */
+KERNEL_SCALAR inline void scaleScalar(float* a, size_t n, float s){
+    for (size_t i = 0; i<n; i++)
+        a[i] *= s;
+}
+
+/**
+ * @brief Scaled addition of float arrays without vector instructions, cf. axpy().
+ *
+ * @param y Amplitudes that are increased
+ * @param x Amplitudes that are added
+ * @param n Number of amplitudes
+ * @param s Scalar
+ */
+KERNEL_SCALAR inline void axpyScalar(float* __restrict y, const float* __restrict x, size_t n, float s){
+    for (size_t i = 0; i<n; i++)
+        y[i] += x[i]*s;
+}
+
+/**
+ * @brief Elementwise squares of a float array without vector instructions, cf. addSq().
+ *
+ * @param r Accumulated squares
+ * @param x Amplitudes
+ * @param n Number of amplitudes
+ */
+KERNEL_SCALAR inline void addSqScalar(float* __restrict r, const float* __restrict x, size_t n){
+    for (size_t i = 0; i<n; i++)
+        r[i] += x[i]*x[i];
+}
+
+/**
+ * @brief Scales a complex float array without vector instructions, cf. scale().
+ *
+ * @param a Amplitudes
+ * @param n Number of amplitudes
+ * @param s Scalar
+ */
+KERNEL_SCALAR inline void scaleCScalar(std::complex<float>* a, size_t n, std::complex<float> s){
+    for (size_t i = 0; i<n; i++)
+        a[i] = mulPlain(a[i], s);
+}
+
+/**
+ * @brief Scaled addition of complex float arrays without vector instructions, cf. axpy().
+ *
+ * @param y Amplitudes that are increased
+ * @param x Amplitudes that are added
+ * @param n Number of amplitudes
+ * @param s Scalar
+ */
+KERNEL_SCALAR inline void axpyCScalar(std::complex<float>* __restrict y, const std::complex<float>* __restrict x, size_t n, std::complex<float> s){
+    for (size_t i = 0; i<n; i++)
+        y[i] += mulPlain(x[i], s);
+}
+
+/**
+ * @brief Scaled addition of float amplitudes to a double accumulator without vector instructions, cf. axpy().
+ *
+ * @param y Accumulator
+ * @param x Amplitudes that are added
+ * @param n Number of amplitudes
+ * @param s Scalar
+ */
+KERNEL_SCALAR inline void axpyDScalar(double* __restrict y, const float* __restrict x, size_t n, double s){
+    for (size_t i = 0; i<n; i++)
+        y[i] += ((double) x[i])*s;
+}
+
+/**
+ * @brief Squares of float amplitudes added to a double accumulator without vector instructions, cf. addSq().
+ *
+ * @param r Accumulated squares
+ * @param x Amplitudes
+ * @param n Number of amplitudes
+ */
+KERNEL_SCALAR inline void addSqDScalar(double* __restrict r, const float* __restrict x, size_t n){
+    for (size_t i = 0; i<n; i++)
+        r[i] += ((double) x[i])*x[i];
+}
+
+#if defined(KERNEL_DISPATCH)
+/**
+ * @brief Squared norm of a float array with AVX2, cf. sqNormScalar().
+ *
+ * @param a Amplitudes
+ * @param n Number of amplitudes
+ * @return double Squared norm
+ */
+KERNEL_AVX2 inline double sqNormAVX2(const float* a, size_t n){
+    double r = 0;
+    float p[KERNEL_LANES];
+    size_t i = 0, e;
+    __m256 s0, s1, x0, x1;
+    while (i<n){
+        e = std::min(n, i+KERNEL_BLOCK);
+        s0 = _mm256_setzero_ps();
+        s1 = _mm256_setzero_ps();
+        for (; i+16<=e; i+=16){
+            x0 = _mm256_loadu_ps(a+i);
+            x1 = _mm256_loadu_ps(a+i+8);
+            s0 = _mm256_add_ps(s0, _mm256_mul_ps(x0, x0));
+            s1 = _mm256_add_ps(s1, _mm256_mul_ps(x1, x1));
+        }
+        _mm256_storeu_ps(p, s0);
+        _mm256_storeu_ps(p+8, s1);
+        r += sqNormBlockEnd(p, a, i, e);
+        i = e;
+    }
+    return r;
+}
+
+/**
+ * @brief Scales a float array with AVX2, cf. scaleScalar().
+ *
+ * @param a Amplitudes
+ * @param n Number of amplitudes
+ * @param s Scalar
+ */
+KERNEL_AVX2 inline void scaleAVX2(float* a, size_t n, float s){
+    size_t i = 0;
+    __m256 v = _mm256_set1_ps(s);
+    for (; i+8<=n; i+=8)
+        _mm256_storeu_ps(a+i, _mm256_mul_ps(_mm256_loadu_ps(a+i), v));
+    for (; i<n; i++)
+        a[i] *= s;
+}
+
+/**
+ * @brief Scaled addition of float arrays with AVX2, cf. axpyScalar().
+ *
+ * @param y Amplitudes that are increased
+ * @param x Amplitudes that are added
+ * @param n Number of amplitudes
+ * @param s Scalar
+ */
+KERNEL_AVX2 inline void axpyAVX2(float* __restrict y, const float* __restrict x, size_t n, float s){
+    size_t i = 0;
+    __m256 v = _mm256_set1_ps(s);
+    for (; i+8<=n; i+=8)
+        _mm256_storeu_ps(y+i, _mm256_add_ps(_mm256_loadu_ps(y+i), _mm256_mul_ps(_mm256_loadu_ps(x+i), v)));
+    for (; i<n; i++)
+        y[i] += x[i]*s;
+}
+
+/**
+ * @brief Elementwise squares of a float array with AVX2, cf. addSqScalar().
+ *
+ * @param r Accumulated squares
+ * @param x Amplitudes
+ * @param n Number of amplitudes
+ */
+KERNEL_AVX2 inline void addSqAVX2(float* __restrict r, const float* __restrict x, size_t n){
+    size_t i = 0;
+    __m256 v;
+    for (; i+8<=n; i+=8){
+        v = _mm256_loadu_ps(x+i);
+        _mm256_storeu_ps(r+i, _mm256_add_ps(_mm256_loadu_ps(r+i), _mm256_mul_ps(v, v)));
+    }
+    for (; i<n; i++)
+        r[i] += x[i]*x[i];
+}
+
+/**
+ * @brief Scales a complex float array with AVX2. The interleaved real and imaginary parts are multiplied with the real and imaginary part of s
+ * in one pass and combined by addsub.
+ *
+ * @param a Amplitudes
+ * @param n Number of amplitudes
+ * @param s Scalar
+ */
+KERNEL_AVX2 inline void scaleCAVX2(std::complex<float>* a, size_t n, std::complex<float> s){
+    size_t i = 0;
+    float* f = reinterpret_cast<float*>(a);
+    __m256 sr = _mm256_set1_ps(s.real()), si = _mm256_set1_ps(s.imag()), x;
+    for (; i+4<=n; i+=4){
+        x = _mm256_loadu_ps(f+2*i);
+        _mm256_storeu_ps(f+2*i, _mm256_addsub_ps(_mm256_mul_ps(x, sr), _mm256_mul_ps(_mm256_permute_ps(x, 0xB1), si)));
+    }
+    for (; i<n; i++)
+        a[i] = mulPlain(a[i], s);
+}
+
+/**
+ * @brief Scaled addition of complex float arrays with AVX2, cf. scaleCAVX2().
+ *
+ * @param y Amplitudes that are increased
+ * @param x Amplitudes that are added
+ * @param n Number of amplitudes
+ * @param s Scalar
+ */
+KERNEL_AVX2 inline void axpyCAVX2(std::complex<float>* __restrict y, const std::complex<float>* __restrict x, size_t n, std::complex<float> s){
+    size_t i = 0;
+    float* fy = reinterpret_cast<float*>(y);
+    const float* fx = reinterpret_cast<const float*>(x);
+    __m256 sr = _mm256_set1_ps(s.real()), si = _mm256_set1_ps(s.imag()), v;
+    for (; i+4<=n; i+=4){
+        v = _mm256_loadu_ps(fx+2*i);
+        v = _mm256_addsub_ps(_mm256_mul_ps(v, sr), _mm256_mul_ps(_mm256_permute_ps(v, 0xB1), si));
+        _mm256_storeu_ps(fy+2*i, _mm256_add_ps(_mm256_loadu_ps(fy+2*i), v));
+    }
+    for (; i<n; i++)
+        y[i] += mulPlain(x[i], s);
+}
+
+/**
+ * @brief Scaled addition of float amplitudes to a double accumulator with AVX2, cf. axpyDScalar().
+ *
+ * @param y Accumulator
+ * @param x Amplitudes that are added
+ * @param n Number of amplitudes
+ * @param s Scalar
+ */
+KERNEL_AVX2 inline void axpyDAVX2(double* __restrict y, const float* __restrict x, size_t n, double s){
+    size_t i = 0;
+    __m256d v = _mm256_set1_pd(s);
+    for (; i+4<=n; i+=4)
+        _mm256_storeu_pd(y+i, _mm256_add_pd(_mm256_loadu_pd(y+i), _mm256_mul_pd(_mm256_cvtps_pd(_mm_loadu_ps(x+i)), v)));
+    for (; i<n; i++)
+        y[i] += ((double) x[i])*s;
+}
+
+/**
+ * @brief Squares of float amplitudes added to a double accumulator with AVX2, cf. addSqDScalar().
+ *
+ * @param r Accumulated squares
+ * @param x Amplitudes
+ * @param n Number of amplitudes
+ */
+KERNEL_AVX2 inline void addSqDAVX2(double* __restrict r, const float* __restrict x, size_t n){
+    size_t i = 0;
+    __m256d v;
+    for (; i+4<=n; i+=4){
+        v = _mm256_cvtps_pd(_mm_loadu_ps(x+i));
+        _mm256_storeu_pd(r+i, _mm256_add_pd(_mm256_loadu_pd(r+i), _mm256_mul_pd(v, v)));
+    }
+    for (; i<n; i++)
+        r[i] += ((double) x[i])*x[i];
+}
+
+/**
+ * @brief Squared norm of a float array with AVX-512, cf. sqNormScalar().
+ *
+ * @param a Amplitudes
+ * @param n Number of amplitudes
+ * @return double Squared norm
+ */
+KERNEL_AVX512 inline double sqNormAVX512(const float* a, size_t n){
+    double r = 0;
+    float p[KERNEL_LANES];
+    size_t i = 0, e;
+    __m512 s, x;
+    while (i<n){
+        e = std::min(n, i+KERNEL_BLOCK);
+        s = _mm512_setzero_ps();
+        for (; i+16<=e; i+=16){
+            x = _mm512_loadu_ps(a+i);
+            s = _mm512_add_ps(s, _mm512_mul_ps(x, x));
+        }
+        _mm512_storeu_ps(p, s);
+        r += sqNormBlockEnd(p, a, i, e);
+        i = e;
+    }
+    return r;
+}
+
+/**
+ * @brief Scales a float array with AVX-512, cf. scaleScalar().
+ *
+ * @param a Amplitudes
+ * @param n Number of amplitudes
+ * @param s Scalar
+ */
+KERNEL_AVX512 inline void scaleAVX512(float* a, size_t n, float s){
+    size_t i = 0;
+    __m512 v = _mm512_set1_ps(s);
+    for (; i+16<=n; i+=16)
+        _mm512_storeu_ps(a+i, _mm512_mul_ps(_mm512_loadu_ps(a+i), v));
+    for (; i<n; i++)
+        a[i] *= s;
+}
+
+/**
+ * @brief Scaled addition of float arrays with AVX-512, cf. axpyScalar().
+ *
+ * @param y Amplitudes that are increased
+ * @param x Amplitudes that are added
+ * @param n Number of amplitudes
+ * @param s Scalar
+ */
+KERNEL_AVX512 inline void axpyAVX512(float* __restrict y, const float* __restrict x, size_t n, float s){
+    size_t i = 0;
+    __m512 v = _mm512_set1_ps(s);
+    for (; i+16<=n; i+=16)
+        _mm512_storeu_ps(y+i, _mm512_add_ps(_mm512_loadu_ps(y+i), _mm512_mul_ps(_mm512_loadu_ps(x+i), v)));
+    for (; i<n; i++)
+        y[i] += x[i]*s;
+}
+
+/**
+ * @brief Elementwise squares of a float array with AVX-512, cf. addSqScalar().
+ *
+ * @param r Accumulated squares
+ * @param x Amplitudes
+ * @param n Number of amplitudes
+ */
+KERNEL_AVX512 inline void addSqAVX512(float* __restrict r, const float* __restrict x, size_t n){
+    size_t i = 0;
+    __m512 v;
+    for (; i+16<=n; i+=16){
+        v = _mm512_loadu_ps(x+i);
+        _mm512_storeu_ps(r+i, _mm512_add_ps(_mm512_loadu_ps(r+i), _mm512_mul_ps(v, v)));
+    }
+    for (; i<n; i++)
+        r[i] += x[i]*x[i];
+}
+#endif
+
+/**
+ * @brief Function pointers to one variant of every float kernel, cf. kernels().
+ *
+ */
+struct KernelTable{
+    /**
+     * @brief Name of the instruction set: "scalar", "avx2" or "avx512".
+     *
+     */
+    const char* isa;
+
+    /**
+     * @brief Whether the CPU converts binary16 in hardware (F16C), cf. Half.hpp.
+     *
+     */
+    bool f16c;
+
+    /**
+     * @brief Squared norm of a float array, cf. sqNormScalar().
+     *
+     */
+    double (*sqNorm)(const float*, size_t);
+
+    /**
+     * @brief Scaling of a float array, cf. scaleScalar().
+     *
+     */
+    void (*scale)(float*, size_t, float);
+
+    /**
+     * @brief Scaled addition of float arrays, cf. axpyScalar().
+     *
+     */
+    void (*axpy)(float* __restrict, const float* __restrict, size_t, float);
+
+    /**
+     * @brief Elementwise squares of a float array, cf. addSqScalar().
+     *
+     */
+    void (*addSq)(float* __restrict, const float* __restrict, size_t);
+
+    /**
+     * @brief Scaling of a complex float array, cf. scaleCScalar().
+     *
+     */
+    void (*scaleC)(std::complex<float>*, size_t, std::complex<float>);
+
+    /**
+     * @brief Scaled addition of complex float arrays, cf. axpyCScalar().
+     *
+     */
+    void (*axpyC)(std::complex<float>* __restrict, const std::complex<float>* __restrict, size_t, std::complex<float>);
+
+    /**
+     * @brief Scaled addition of floats to doubles, cf. axpyDScalar().
+     *
+     */
+    void (*axpyD)(double* __restrict, const float* __restrict, size_t, double);
+
+    /**
+     * @brief Squares of floats added to doubles, cf. addSqDScalar().
+     *
+     */
+    void (*addSqD)(double* __restrict, const float* __restrict, size_t);
+};
+
+/**
+ * @brief Selects the kernel variants by CPUID. The environment variable KERNEL_ISA ("scalar", "avx2" or "avx512") forces a variant, e.g. for benchmarking,
+ * as long as the CPU supports it.
+ *
+ * @return KernelTable The selected variants
+ */
+inline KernelTable kernelSelect(){
+    KernelTable t = {"scalar", false, &sqNormScalar, &scaleScalar, &axpyScalar, &addSqScalar, &scaleCScalar, &axpyCScalar, &axpyDScalar, &addSqDScalar};
+#if defined(KERNEL_DISPATCH)
+    __builtin_cpu_init();
+    bool avx2 = __builtin_cpu_supports("avx2"), avx512 = avx2 && __builtin_cpu_supports("avx512f");
+    t.f16c = __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c");
+    const char* env = std::getenv("KERNEL_ISA");
+    if (env != nullptr && std::strcmp(env, "scalar") == 0)
+        avx2 = avx512 = false;
+    else if (env != nullptr && std::strcmp(env, "avx2") == 0)
+        avx512 = false;
+    if (avx2)
+        t = {"avx2", t.f16c, &sqNormAVX2, &scaleAVX2, &axpyAVX2, &addSqAVX2, &scaleCAVX2, &axpyCAVX2, &axpyDAVX2, &addSqDAVX2};
+    if (avx512){ //the complex and mixed kernels have no AVX-512 variant
+        t.isa = "avx512";
+        t.sqNorm = &sqNormAVX512;
+        t.scale = &scaleAVX512;
+        t.axpy = &axpyAVX512;
+        t.addSq = &addSqAVX512;
+    }
+#endif
+    return t;
+}
+
+/**
+ * @brief The kernel variants of this process, selected on first use, cf. kernelSelect().
+ *
+ * @return const KernelTable& The selected variants
+ */
+inline const KernelTable& kernels(){
+    static const KernelTable t = kernelSelect();
+    return t;
+}
+
+/**
+ * @brief Name of the selected instruction set, for the run log.
+ *
+ * @return const char* "scalar", "avx2" or "avx512"
+ */
+inline const char* kernelISA(){return kernels().isa;}
+
+/**
+ * @brief Squared norm of a float array, cf. sqNorm(). Blocks of KERNEL_BLOCK amplitudes are summed in float at full vector width,
+ * the block sums are accumulated in double.
+ *
+ * @param a Amplitudes
+ * @param n Number of amplitudes
+ * @return double Squared norm
+ */
+inline double sqNorm(const float* a, size_t n){
+    return (n < KERNEL_SHORT) ? sqNormScalar(a, n) : kernels().sqNorm(a, n);
+}
+
+/**
+ * @brief Squared norm of a complex float array, the real and imaginary parts are handled as one float array.
+ *
+ * @param a Amplitudes
+ * @param n Number of amplitudes
+ * @return double Squared norm
+ */
+inline double sqNorm(const std::complex<float>* a, size_t n){
+    return sqNorm(reinterpret_cast<const float*>(a), 2*n);
+}
+
+/**
+ * @brief Scales an array, a *= s.
+ *
+ * @tparam Val Amplitude type
+ * @param a Amplitudes
+ * @param n Number of amplitudes
+ * @param s Scalar
+ */
+template<class Val>
+inline void scale(Val* a, size_t n, const Val& s){
+    for (size_t i = 0; i<n; i++)
+        a[i] *= s;
+}
+
+/**
+ * @brief Scales a float array, cf. scale().
+ *
+ * @param a Amplitudes
+ * @param n Number of amplitudes
+ * @param s Scalar
+ */
+inline void scale(float* a, size_t n, float s){
+    if (n < KERNEL_SHORT) scaleScalar(a, n, s);
+    else kernels().scale(a, n, s);
+}
+
+/**
+ * @brief Scaled addition, y += s*x. The types may differ, e.g. for accumulators in higher precision (cf. Accum), the product is taken in the type of y.
+ *
+ * @tparam T Amplitude type of y
+ * @tparam U Amplitude type of x
+ * @tparam S Type of the scalar
+ * @param y Amplitudes that are increased
+ * @param x Amplitudes that are added
+ * @param n Number of amplitudes
+ * @param s Scalar
+ */
+template<class T, class U, class S>
+inline void axpy(T* y, const U* x, size_t n, const S& s){
+    T t = (T) s;
+    for (size_t i = 0; i<n; i++)
+        y[i] += mulPlain((T) x[i], t);
+}
+
+/**
+ * @brief Scaled addition for float arrays, cf. axpy().
+ *
+ * @param y Amplitudes that are increased
+ * @param x Amplitudes that are added
+ * @param n Number of amplitudes
+ * @param s Scalar
+ */
+inline void axpy(float* __restrict y, const float* __restrict x, size_t n, float s){
+    if (n < KERNEL_SHORT) axpyScalar(y, x, n, s);
+    else kernels().axpy(y, x, n, s);
+}
+
+/**
+ * @brief Adds the squared absolute values elementwise, r += |x|^2.
+ *
+ * @tparam Real Real number type
+ * @tparam Val Amplitude type
+ * @param r Accumulated squares
+ * @param x Amplitudes
+ * @param n Number of amplitudes
+ */
+template<class Real, class Val>
+inline void addSq(Real* r, const Val* x, size_t n){
+    for (size_t i = 0; i<n; i++)
+        r[i] += absSq(x[i]);
+}
+
+/**
+ * @brief Adds the squared absolute values elementwise for float arrays, cf. addSq(). Used for the norms of lanes, cf. LaneAcc.
+ *
+ * @param r Accumulated squares
+ * @param x Amplitudes
+ * @param n Number of amplitudes
+ */
+inline void addSq(float* __restrict r, const float* __restrict x, size_t n){
+    if (n < KERNEL_SHORT) addSqScalar(r, x, n);
+    else kernels().addSq(r, x, n);
+}
+
+/**
+ * @brief Scales a complex float array, cf. scale().
+ *
+ * @param a Amplitudes
+ * @param n Number of amplitudes
+ * @param s Scalar
+ */
+inline void scale(std::complex<float>* a, size_t n, std::complex<float> s){
+    if (n < KERNEL_SHORT) scaleCScalar(a, n, s);
+    else kernels().scaleC(a, n, s);
+}
+
+/**
+ * @brief Scaled addition for complex float arrays, cf. axpy().
+ *
+ * @param y Amplitudes that are increased
+ * @param x Amplitudes that are added
+ * @param n Number of amplitudes
+ * @param s Scalar
+ */
+inline void axpy(std::complex<float>* __restrict y, const std::complex<float>* __restrict x, size_t n, std::complex<float> s){
+    if (n < KERNEL_SHORT) axpyCScalar(y, x, n, s);
+    else kernels().axpyC(y, x, n, s);
+}
+
+/**
+ * @brief Scaled addition of float amplitudes to a double accumulator, y += s*x, cf. axpy().
+ *
+ * @param y Accumulator
+ * @param x Amplitudes that are added
+ * @param n Number of amplitudes
+ * @param s Scalar
+ */
+inline void axpy(double* __restrict y, const float* __restrict x, size_t n, double s){
+    if (n < KERNEL_SHORT) axpyDScalar(y, x, n, s);
+    else kernels().axpyD(y, x, n, s);
+}
+
+/**
+ * @brief Adds the squared float amplitudes elementwise to a double accumulator, r += |x|^2, cf. addSq().
+ *
+ * @param r Accumulated squares
+ * @param x Amplitudes
+ * @param n Number of amplitudes
+ */
+inline void addSq(double* __restrict r, const float* __restrict x, size_t n){
+    if (n < KERNEL_SHORT) addSqDScalar(r, x, n);
+    else kernels().addSqD(r, x, n);
+}
+
+#endif
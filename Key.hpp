@@ -40,6 +40,7 @@ DEALINGS IN THE SOFTWARE.
 #include <boost/container/flat_map.hpp>
 #include <boost/algorithm/string.hpp>
 #include "KeyAux.hpp"
+#include "Kernels.hpp"
 
 /**
  * @brief Key class, that implements the functions needed for State. Inherits from boost::container::flat_map<std::pair<Int, Int>, Int>.
@@ -138,7 +139,8 @@ class Key : public boost::container::flat_map<std::pair<Int, Int>, Int>{
         for (typename Par::const_iterator it = Par::cbegin(); it!= Par::cend(); it++){
             if (it->first.first== a || it->first.first== b) r*= (Val) facut(it->second);
         }
-        return std::sqrt(r);
+        using std::sqrt;
+        return sqrt(r);
     }
 
     /**
@@ -153,7 +155,8 @@ class Key : public boost::container::flat_map<std::pair<Int, Int>, Int>{
         for (typename Par::const_iterator it = Par::cbegin(); it!= Par::cend(); it++){
             r*= (Val) facut(it->second);
         }
-        return std::sqrt(r);
+        using std::sqrt;
+        return sqrt(r);
     }
 
     /**
@@ -165,6 +168,19 @@ class Key : public boost::container::flat_map<std::pair<Int, Int>, Int>{
      */
     void addEnd(const Int& a, const Int& b, const Int& c){Par::insert_or_assign(Par::cend(), std::make_pair(a, b), c);}
 
+    /**
+     * @brief Increases the occupation number of an entry, if the entry does not exist it is added.
+     * 
+     * @param a Spatial&Polarization mode
+     * @param b Distinguishability mode
+     * @param c Occupation number to add
+     */
+    void incr(const Int& a, const Int& b, const Int& c){
+        std::pair<typename Par::iterator, bool> pib = Par::emplace(std::make_pair(a, b), c);
+        if (!pib.second)
+            pib.first->second += c;
+    }
+
     /**
      * @brief Applies a Unitary in second quantization.
      * 
@@ -173,10 +189,11 @@ class Key : public boost::container::flat_map<std::pair<Int, Int>, Int>{
      * @param U Unitary in line format
      * @param modes Affected modes, max 2.
      * @param tol Tolerance for the aplitude, amplitude with absolute value lower than tol are discarded
+     * @param dropped If given, the squared norm of the discarded amplitudes is added to it
      * @return SD<Val> State similar data structure one gets, if one applies U on the implicit state (Key : 1.0).
      */
     template<class Val, class Real>
-    inline SD<Val> apply(const std::vector<Val>& U, const std::vector<Int>& modes, const Real& tol) const {
+    inline SD<Val> apply(const std::vector<Val>& U, const std::vector<Int>& modes, const Real& tol, accum_t<Real>* dropped = nullptr) const {
         SD<Val> Ret, RetIter, RetIter2;
         Key K;
         Ret.insert(std::make_pair(K, (Val) 1.0));
@@ -203,8 +220,8 @@ class Key : public boost::container::flat_map<std::pair<Int, Int>, Int>{
             i = (m == a) ? 0 : 1;
             
             for (Int j= 0; j<= n; j++){
-                amp *= (Val) std::pow(U[i], j) * binomialCoeff<Val, Int>(n, j);
-                amp *= (Val) std::pow(U[i+2], n-j)/((Val) std::sqrt(facut(n)));
+                amp *= ipow(U[i], j) * binomialCoeff<Val, Int>(n, j);
+                amp *= ipow(U[i+2], n-j)/((Val) std::sqrt(facut(n)));
                 K = Key(modes[0], d, j);
                 K.insert_or_assign(std::make_pair(modes[1], d), n-j);
                 K.clean();
@@ -216,7 +233,7 @@ class Key : public boost::container::flat_map<std::pair<Int, Int>, Int>{
                 for (typename SD<Val>::iterator rit = Ret.begin(); rit != Ret.end(); rit++){
                     K = riit->first;
                     K.add(rit->first);
-                    pr = std::make_pair(K, (riit->second) * (rit->second));
+                    pr = std::make_pair(K, mulPlain(riit->second, rit->second));
                     pib = RetIter2.emplace(pr);
                     if (!pib.second)
                         pib.first->second += pr.second;
@@ -226,8 +243,10 @@ class Key : public boost::container::flat_map<std::pair<Int, Int>, Int>{
             RetIter.clear();
         }
         for (typename SD<Val>::iterator it = Ret.begin(); it != Ret.end(); it++){
-            if (std::abs(it->second) > tol)
-                RetIter.insert_or_assign(RetIter.cend(), it->first, it->second * it->first.template factor<Val>(a, b));}
+            if (truncWeight(it->second) > tol*tol)
+                RetIter.insert_or_assign(RetIter.cend(), it->first, it->second * it->first.template factor<Val>(a, b));
+            else if (dropped)
+                *dropped += (accum_t<Real>) truncWeight(it->second * it->first.template factor<Val>(a, b));}
         return RetIter;
     }
 
@@ -248,7 +267,7 @@ class Key : public boost::container::flat_map<std::pair<Int, Int>, Int>{
                 a += (it->second);
             }
         }
-        return std::pow(U, a);
+        return ipow(U, a);
     }
 
     /**
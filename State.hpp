@@ -36,10 +36,17 @@ DEALINGS IN THE SOFTWARE.
 #include <array>
 #include <utility>
 #include <functional>
+#include <limits>
+#include <cstdint>
+#include <type_traits>
 #include <stdio.h>
 #include <boost/container/flat_map.hpp>
 #include <boost/algorithm/string.hpp>
 #include "StateAux.hpp" 
+#include "Kernels.hpp"
+#include "Half.hpp"
+#include "Dual.hpp"
+#include "Batch.hpp"
 
 /**
  * @brief Definition of the data structure used to represent states. Inherits from boost::container::flat_map<Key, Val>.
@@ -98,6 +105,60 @@ class State : public boost::container::flat_map<Key, Val>{
      */
     Real tol = (Real) std::pow(10, -9);
 
+    /**
+     * @brief Budget for the discarded squared norm. If positive, the truncation threshold is chosen adaptively instead of tol, cf. compactBudget().
+     * 
+     */
+    accum_t<Real> budget = 0;
+
+    /**
+     * @brief Squared norm of all amplitudes discarded so far, each at the time of its truncation.
+     * 
+     */
+    accum_t<Real> truncSq = 0;
+
+    /**
+     * @brief Sum of the norms of the parts discarded by the single truncations. As long as only norm-preserving maps are applied, this bounds the norm of the total discarded part (triangle inequality).
+     * 
+     */
+    accum_t<Real> truncNorm = 0;
+
+    /**
+     * @brief Records a truncation that discarded the squared norm d.
+     * 
+     * @param d Discarded squared norm
+     */
+    inline void addTrunc(accum_t<Real> d){
+        if (d > 0){
+            truncSq += d;
+            truncNorm += std::sqrt(d);
+        }
+    }
+
+    /**
+     * @brief Adds f(v) for all Key-Val pairs (k, v) of p, both are sorted by key. Keys that are already in the State are updated in a first pass, the new ones are inserted or, if there are many, merged in a second pass.
+     * 
+     * @tparam F Callable that maps an amplitude of p to the added amplitude
+     * @param p State-like object to be added
+     * @param f Applied to the amplitudes of p
+     */
+    template<class F>
+    inline void mergeAdd(const Par& p, F f);
+
+    /**
+     * @brief Removes all Key-Val pairs where the abs of the amplitude is not above tol, in place and keeping the order. With a budget compactBudget() is used instead.
+     * The discarded squared norm is recorded in truncSq and truncNorm.
+     * 
+     */
+    inline void compactTol();
+
+    /**
+     * @brief Removes the Key-Val pairs with the smallest absolute values, as many as fit into half of the remaining budget, in place and keeping the order.
+     * The threshold adapts to the state, i.e. the kept keys are the ones with the largest weights and the total discarded squared norm never exceeds the budget.
+     * 
+     */
+    inline void compactBudget();
+
     /**
      * @brief Loss is modelled as a map to a new Spatial&Polarization mode. This mode should be always higher than modes used for computation.
      * 
@@ -133,6 +194,28 @@ class State : public boost::container::flat_map<Key, Val>{
          */
         inline void set(Real t){tol = t;}
 
+        /**
+         * @brief Sets the budget for the discarded squared norm. With a positive budget the truncations choose their threshold adaptively (cf. compactBudget()), with 0 tol is used.
+         * 
+         * @param b Budget, the discarded squared norm so far (cf. truncated()) is counted against it
+         */
+        inline void setBudget(accum_t<Real> b){budget = b;}
+
+        /**
+         * @brief Returns the squared norm discarded by all truncations so far, i.e. in clean(), mul(), normalise() and apply().
+         * 
+         * @return accum_t<Real> Discarded squared norm
+         */
+        inline accum_t<Real> truncated() const {return truncSq;}
+
+        /**
+         * @brief Returns the sum of the norms discarded by the single truncations, a bound on the norm of the difference to the untruncated state for norm-preserving maps.
+         * It bounds the unnormalized amplitudes only: quantities normalized by a post-selected norm, e.g. a fidelity, can shift by a different amount.
+         * 
+         * @return accum_t<Real> Bound on the norm of the discarded part
+         */
+        inline accum_t<Real> truncBound() const {return truncNorm;}
+
         /**
          * @brief Sets the lossMode to n.
          * 
@@ -145,7 +228,7 @@ class State : public boost::container::flat_map<Key, Val>{
          * 
          * @param p The data is set to. Moved input.
          */
-        inline void set(Par&& p) noexcept {Par::operator=(p);}
+        inline void set(Par&& p) noexcept {Par::operator=(std::move(p));}
 
         /**
          * @brief Sets the actual State data to p.
@@ -209,6 +292,13 @@ class State : public boost::container::flat_map<Key, Val>{
         */
         inline Real norm() const;
 
+        /**
+        * @brief Returns the squared norm of a state, accumulated in higher precision (cf. Accum). Large states are summed in chunks of REDUCE_CHUNK keys, cf. pairwiseReduce().
+        * 
+        * @return sqnorm_t<Val> The squared norm of the state, with its derivatives for Dual amplitudes
+        */
+        inline sqnorm_t<Val> normSq() const;
+
         /**
          * @brief Get the Par, i.e. boost::container::flat_map<Key, Val>,  object
          * 
@@ -332,61 +422,113 @@ class State : public boost::container::flat_map<Key, Val>{
         * @param facs Factors associated to the vectors in modes. These are used for the amplitudes correspoding to the keys, in which all the modes in the correspoding vector have the same Distinguishability Modes. 
         */
         inline void sameDModeDel(const std::vector<std::vector<Int>>&, const std::vector<Val>&);
+
+        /**
+        * @brief Writes the Key-Val pairs, the lossMode and the discarded norms (cf. truncated()) to a binary stream, e.g. to resume a circuit from a snapshot (cf. fidSnapshot()).
+        * The other settings and the wave functions are not written. The amplitudes are written bytewise, i.e. the stream can only be read with the same Key and Val type.
+        * 
+        * @param os Binary stream
+        */
+        inline void save(std::ostream& os) const;
+
+        /**
+        * @brief Reads the data written by save(), the other settings and the wave functions are kept.
+        * 
+        * @param is Binary stream
+        * @return bool Whether the stream was complete and written with the same Key and Val type, otherwise the State is unchanged
+        */
+        inline bool load(std::istream& is);
 };
 
 template<class Key, class Val, class Real>
-inline void State<Key, Val, Real>::add(const Par& p){
-    bool nfound;
-    typename Par::iterator rit;
-    std::pair<typename Par::iterator, bool> pbi;
-    for (typename Par::const_iterator it=p.cbegin(); it != p.cend(); it++){
-        pbi = Par::emplace(std::make_pair(it->first, it->second));
-        rit = pbi.first;
-        nfound = pbi.second;
-        if (!nfound){
-            rit->second += it->second;
+template<class F>
+inline void State<Key, Val, Real>::mergeAdd(const Par& p, F f){
+    typename Par::iterator rit = Par::begin();
+    size_t fresh = 0, c = (p.size()+REDUCE_CHUNK-1)/REDUCE_CHUNK;
+    std::vector<size_t> freshPart(c, 0);
+    KERNEL_PARALLEL_FOR(c)
+    for (size_t k = 0; k<c; k++){ //every key receives at most one addition, the chunks of p update disjoint keys
+        typename Par::const_iterator it = p.cbegin()+k*REDUCE_CHUNK, e = p.cbegin()+std::min(p.size(), (k+1)*REDUCE_CHUNK);
+        typename Par::iterator r = std::lower_bound(Par::begin(), Par::end(), *it, Par::value_comp());
+        for (; it != e; it++){
+            r = std::lower_bound(r, Par::end(), *it, Par::value_comp());
+            if (r != Par::end() && !(it->first < r->first))
+                r->second += f(it->second);
+            else
+                freshPart[k]++;
+        }
+    }
+    for (size_t k : freshPart)
+        fresh += k;
+    if (fresh == 0) return;
+    if (fresh*8 < Par::size()){ //few new keys, inserting them is cheaper than rebuilding
+        rit = Par::begin();
+        for (typename Par::const_iterator it=p.cbegin(); it != p.cend(); it++){
+            rit = std::lower_bound(rit, Par::end(), *it, Par::value_comp());
+            if (rit == Par::end() || it->first < rit->first)
+                rit = Par::emplace_hint(rit, it->first, f(it->second));
+        }
+        return;
+    }
+    typename Par::sequence_type seq;
+    seq.reserve(Par::size()+fresh);
+    typename Par::iterator a = Par::begin();
+    typename Par::const_iterator b = p.cbegin();
+    while (a != Par::end() || b != p.cend()){
+        if (b == p.cend() || (a != Par::end() && a->first < b->first))
+            seq.push_back(std::move(*(a++)));
+        else if (a == Par::end() || b->first < a->first){
+            seq.emplace_back(b->first, f(b->second));
+            b++;
+        }
+        else { //already updated in the first pass
+            seq.push_back(std::move(*(a++)));
+            b++;
         }
     }
+    Par::adopt_sequence(boost::container::ordered_unique_range, std::move(seq));
+}
+
+template<class Key, class Val, class Real>
+inline void State<Key, Val, Real>::add(const Par& p){
+    mergeAdd(p, [](const Val& x){return x;});
 }
 
 template<class Key, class Val, class Real>
 inline void State<Key, Val, Real>::add(Par&& p){
-    bool nfound;
-    typename Par::iterator rit;
-    std::pair<typename Par::iterator, bool> pbi;
-    for (typename Par::iterator it=p.begin(); it != p.end(); it++){
-        pbi = Par::emplace(std::make_pair(it->first, it->second));
-        rit = pbi.first;
-        nfound = pbi.second;
-        if (!nfound){
-            rit->second += it.second;
-        }
-    }
+    mergeAdd(p, [](const Val& x){return x;});
     p.clear();
 }
 
 template<class Key, class Val, class Real>
 inline void State<Key, Val, Real>::add(const Par& p, const Val& v){
-    bool nfound;
-    typename Par::iterator rit;
-    std::pair<typename Par::iterator, bool> pbi;
-    for (typename Par::const_iterator it=p.cbegin(); it != p.cend(); it++){
-        pbi = Par::emplace(it->first, v*(it->second));
-        rit = pbi.first;
-        nfound = pbi.second;
-        if (!nfound){
-            rit->second += (v * it->second);
-        }
-    }
+    mergeAdd(p, [&v](const Val& x){return mulPlain(v, x);});
 }
  
 template<class Key, class Val, class Real>
-inline Real State<Key, Val, Real>::norm() const {
-    Real r = 0;
-    for (typename Par::const_iterator it = Par::cbegin(); it != Par::cend(); it++){
-        r += std::pow(std::abs(it->second), 2);
+inline sqnorm_t<Val> State<Key, Val, Real>::normSq() const {
+    size_t c = (Par::size()+REDUCE_CHUNK-1)/REDUCE_CHUNK;
+    if (c <= 1){
+        sqnorm_t<Val> r = 0;
+        for (typename Par::const_iterator it = Par::cbegin(); it != Par::cend(); it++)
+            r += absSq(it->second);
+        return r;
     }
-    return std::sqrt(r);
+    std::vector<sqnorm_t<Val>> part(c, 0.0);
+    KERNEL_PARALLEL_FOR(c)
+    for (size_t k = 0; k<c; k++){
+        typename Par::const_iterator it = Par::cbegin()+k*REDUCE_CHUNK, e = Par::cbegin()+std::min(Par::size(), (k+1)*REDUCE_CHUNK);
+        for (; it != e; it++)
+            part[k] += absSq(it->second);
+    }
+    pairwiseReduce(part, [](sqnorm_t<Val>& a, sqnorm_t<Val>& b){a += b;});
+    return part[0];
+}
+
+template<class Key, class Val, class Real>
+inline Real State<Key, Val, Real>::norm() const {
+    using std::sqrt;
+    return (Real) sqrt(normSq());
 }
 
 template<class Key, class Val, class Real>
@@ -403,7 +545,8 @@ std::vector<Val> State<Key, Val, Real>::addBasisElem(const WF& wf){
     bNew.push_back((Val) 1.0);
     waves.push_back(wf);
     Val normC = ovlp<Val, Real>(bNew, bNew, get_ovlp, waves);
-    Real norm = std::abs(normC);
+    using std::abs;
+    Real norm = abs(normC);
     for (int i = 0;i<bNew.size();i++){
         bNew[i] = bNew[i] / std::sqrt(norm);
     }
@@ -411,7 +554,7 @@ std::vector<Val> State<Key, Val, Real>::addBasisElem(const WF& wf){
     decomp.push_back(ovlpH<Val, Real>(bNew, wf, get_ovlp, waves));
     Real norm2 = 0;
     for (Val a : decomp){
-        norm2 += std::pow(std::abs(a), 2);
+        norm2 += std::pow(abs(a), 2);
     }
     if (norm2!=0){
     for (int i = 0;i<bNew.size();i++){
@@ -431,8 +574,9 @@ void State<Key, Val, Real>::addPhoton(const WF& wf, Int mode, Int num){
         return;
     }
     Int index = -1;
+    using std::abs;
     for (Int i = 0; i<waves.size();i++){
-        if (std::abs(get_ovlp(wf, waves[i])) == (Real) 1.0) {index = i; break;}
+        if (abs(get_ovlp(wf, waves[i])) == (Real) 1.0) {index = i; break;}
     }
     if (index!= -1){
         Par SNew;
@@ -465,11 +609,20 @@ template<class Key, class Val, class Real>
 inline void State<Key, Val, Real>::apply(const std::vector<Val>& U, const std::vector<Int>& modes){
     Par S = get_parMoved(), S2;
     std::pair<Key, Val> p;
+    accum_t<Real> d, dSq = 0, dNorm = 0;
+    Real t = (budget > 0) ? (Real) 0.0 : tol; //with a budget only the adaptive truncation in clean() is used
     for (typename Par::iterator it = S.begin(); it!=S.end(); it++){
         p = (*it);
-        S2 = p.first.apply(U, modes, tol);
+        d = 0;
+        S2 = p.first.apply(U, modes, t, &d);
         add(S2, p.second);
+        if (d > 0){
+            dSq += (accum_t<Real>) truncWeight(p.second)*d;
+            dNorm += std::sqrt((accum_t<Real>) truncWeight(p.second)*d);
+        }
     }
+    truncSq += dSq;
+    truncNorm += dNorm;
     clean();
 }
 
@@ -480,7 +633,7 @@ inline void State<Key, Val, Real>::apply(const Val& U, const Int& mode){
     for (typename Par::iterator it = Par::begin(); it!=Par::end(); it++){
         p = (*it);
         v = p.second;
-        it->second = v*p.first.apply(U, mode);
+        it->second = mulPlain(v, p.first.apply(U, mode));
     }
 }
 
@@ -496,44 +649,63 @@ inline void State<Key, Val, Real>::swap(Int a, Int b){
     set(std::move(par));
 }
 
+template<class Key, class Val, class Real>
+inline void State<Key, Val, Real>::compactTol(){
+    if (budget > 0){
+        compactBudget();
+        return;
+    }
+    accum_t<Real> d = 0;
+    Real t2 = tol*tol;
+    Par::erase(std::remove_if(Par::begin(), Par::end(), [&d, t2](const std::pair<Key, Val>& p){
+        Real a = (Real) truncWeight(p.second);
+        if (a > t2) return false;
+        d += a;
+        return true;}), Par::end());
+    addTrunc(d);
+}
+
+template<class Key, class Val, class Real>
+inline void State<Key, Val, Real>::compactBudget(){
+    accum_t<Real> allow = std::max((accum_t<Real>) 0.0, (budget-truncSq)/2), d = 0, theta;
+    std::vector<accum_t<Real>> w;
+    w.reserve(Par::size());
+    for (typename Par::const_iterator it = Par::cbegin(); it != Par::cend(); it++)
+        w.push_back((accum_t<Real>) truncWeight(it->second));
+    std::sort(w.begin(), w.end());
+    size_t k = 0;
+    for (; k<w.size() && d+w[k] <= allow; k++)
+        d += w[k];
+    if (k == 0) return;
+    theta = (k == w.size()) ? std::numeric_limits<accum_t<Real>>::infinity() : w[k]; //strictly below theta, ties with w[k] are kept
+    d = 0;
+    Par::erase(std::remove_if(Par::begin(), Par::end(), [&d, theta](const std::pair<Key, Val>& p){
+        accum_t<Real> a = (accum_t<Real>) truncWeight(p.second);
+        if (a >= theta) return false;
+        d += a;
+        return true;}), Par::end());
+    addTrunc(d);
+}
+
 template<class Key, class Val, class Real>
 inline void State<Key, Val, Real>::clean(){
-    std::pair<Key, Val> p;
-    Par par;
-    for (typename Par::iterator it = Par::begin(); it!=Par::end(); it++){
-        p = (*it);
-        if (std::abs(p.second)>tol){
-        par.insert(par.cend(), std::move(p));}
-        }
-    set(std::move(par));
+    compactTol();
 }
 
 template<class Key, class Val, class Real>
 inline void State<Key, Val, Real>::normalise(){
-    std::pair<Key, Val> p;
     Val n = norm();
     if (n == (Val) 0.0) n = 1.0;
-    Par par;
-    for (typename Par::iterator it = Par::begin(); it!=Par::end(); it++){
-        p = (*it);
-        p.second /= n;
-        if (std::abs(p.second)>tol){
-            par.insert(par.cend(), std::move(p));}
-        }
-    set(std::move(par));
+    for (typename Par::iterator it = Par::begin(); it!=Par::end(); it++)
+        it->second /= n;
+    compactTol();
 }
 
 template<class Key, class Val, class Real>
 inline void State<Key, Val, Real>::mul(Val n){
-    std::pair<Key, Val> p;
-    Par par;
-    for (typename Par::iterator it = Par::begin(); it!=Par::end(); it++){
-        p = (*it);
-        p.second *= n;
-        if (std::abs(p.second)>tol){
-            par.insert(par.cend(), std::move(p));}
-        }
-    set(std::move(par));
+    for (typename Par::iterator it = Par::begin(); it!=Par::end(); it++)
+        it->second = mulPlain(it->second, n);
+    compactTol();
 }
  
 template<class Key, class Val, class Real>
@@ -641,4 +813,84 @@ inline void State<Key, Val, Real>::sameDModeDel(const std::vector<std::vector<In
     }
     set(std::move(p));
 }
+template<class Key, class Val, class Real>
+inline void State<Key, Val, Real>::save(std::ostream& os) const {
+    static_assert(std::is_trivially_copyable<Val>::value, "amplitudes are written bytewise");
+    const uint64_t head[3] = {sizeof(Int), sizeof(Val), Par::size()};
+    const accum_t<Real> tr[2] = {truncSq, truncNorm};
+    os.write(reinterpret_cast<const char*>(head), sizeof(head));
+    os.write(reinterpret_cast<const char*>(&lossMode), sizeof(Int));
+    os.write(reinterpret_cast<const char*>(tr), sizeof(tr));
+    std::vector<Int> d;
+    uint64_t n;
+    for (typename Par::const_iterator it = Par::cbegin(); it != Par::cend(); it++){
+        d.clear();
+        for (typename Key::const_iterator kit = it->first.cbegin(); kit != it->first.cend(); kit++){
+            d.push_back(kit->first.first);
+            d.push_back(kit->first.second);
+            d.push_back(kit->second);
+        }
+        n = it->first.size();
+        os.write(reinterpret_cast<const char*>(&n), sizeof(n));
+        os.write(reinterpret_cast<const char*>(d.data()), d.size()*sizeof(Int));
+        os.write(reinterpret_cast<const char*>(&it->second), sizeof(Val));
+    }
+}
+
+template<class Key, class Val, class Real>
+inline bool State<Key, Val, Real>::load(std::istream& is){
+    static_assert(std::is_trivially_copyable<Val>::value, "amplitudes are read bytewise");
+    uint64_t head[3], n;
+    Int lm;
+    accum_t<Real> tr[2];
+    if (!is.read(reinterpret_cast<char*>(head), sizeof(head)) || head[0] != sizeof(Int) || head[1] != sizeof(Val))
+        return false;
+    if (!is.read(reinterpret_cast<char*>(&lm), sizeof(Int)) || !is.read(reinterpret_cast<char*>(tr), sizeof(tr)))
+        return false;
+    typename Par::sequence_type seq;
+    seq.reserve(head[2]);
+    std::vector<Int> d;
+    Key K;
+    Val v;
+    for (uint64_t i = 0; i<head[2]; i++){
+        if (!is.read(reinterpret_cast<char*>(&n), sizeof(n)))
+            return false;
+        d.resize(3*n);
+        if (!is.read(reinterpret_cast<char*>(d.data()), d.size()*sizeof(Int)) || !is.read(reinterpret_cast<char*>(&v), sizeof(Val)))
+            return false;
+        K.clear();
+        for (uint64_t e = 0; e<n; e++)
+            K.addEnd(d[3*e], d[3*e+1], d[3*e+2]);
+        seq.emplace_back(K, v);
+    }
+    Par::clear();
+    Par::adopt_sequence(boost::container::ordered_unique_range, std::move(seq)); //written in the order of the keys
+    lossMode = lm;
+    truncSq = tr[0];
+    truncNorm = tr[1];
+    return true;
+}
+
+/**
+ * @brief Converts the amplitudes of a State to another amplitude type, e.g. to store them in reduced precision (cf. Half.hpp). The keys and their order are kept,
+ * the settings (tolerance, lossMode and overlap function) are the defaults of the new State.
+ * 
+ * @tparam Val2 Amplitude type of the result
+ * @tparam Key Key type used in the State
+ * @tparam Val Amplitude type used in the State
+ * @tparam Real Real number type used in the State
+ * @param S State to convert
+ * @return State<Key, Val2, Real> State with the converted amplitudes
+ */
+template<class Val2, class Key, class Val, class Real>
+inline State<Key, Val2, Real> convertState(const State<Key, Val, Real>& S){
+    typename boost::container::flat_map<Key, Val2>::sequence_type seq;
+    seq.reserve(S.size());
+    for (typename State<Key, Val, Real>::const_iterator it = S.cbegin(); it != S.cend(); it++)
+        seq.emplace_back(it->first, (Val2) it->second);
+    State<Key, Val2, Real> T;
+    T.adopt_sequence(boost::container::ordered_unique_range, std::move(seq));
+    return T;
+}
+
 #endif
\ No newline at end of file
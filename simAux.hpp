@@ -28,6 +28,22 @@ DEALINGS IN THE SOFTWARE.
 template<class T>
 using CNum = std::complex<T>;
 
+/**
+ * @brief Entries cos and sin of the rotation of a wave plate with error err (in degree), cf. genRotationsBasic().
+ *
+ * @tparam V Value-type, cf. State
+ * @tparam R Real-type, cf. State
+ * @param err Rotation error
+ * @param i Index of the wave plate, the variable of i for dual numbers (cf. Dual.hpp)
+ * @param c Output: cos(45°+err)
+ * @param s Output: sin(45°+err)
+ */
+template<class V, class R>
+inline void rotation(R err, int /*i*/, V& c, V& s){
+    c = std::cos((45.0+err)/180.0*numbers::pi);
+    s = std::sin((45.0+err)/180.0*numbers::pi);
+}
+
 /**
  * @brief Generate the rotation unitaries used for the wave-plates including the errors
  * 
@@ -42,8 +58,7 @@ std::array<std::vector<V>, 15> genRotationsBasic(const std::vector<R>& angleErrs
     std::vector<V> U = {0, 0, 0, 0};
     V emix, epix;
     for (int i= 0;i<15;i++){
-		emix = std::cos((45.0+angleErrs[i])/180.0*numbers::pi);
-        epix = std::sin((45.0+angleErrs[i])/180.0*numbers::pi);
+        rotation(angleErrs[i], i, emix, epix);
         U[0] = emix;
         U[1] = epix;
         U[2] = epix;
@@ -52,10 +67,51 @@ std::array<std::vector<V>, 15> genRotationsBasic(const std::vector<R>& angleErrs
     return Ops;
 }
 
+/**
+ * @brief Generate the rotation unitaries for a batch of samples of the errors, sample l in lane l of V (cf. Batch.hpp). If there are less samples than
+ * lanes, the samples are repeated.
+ * 
+ * @tparam V Value-type, e.g. Batch<float, 16>, cf. State
+ * @tparam R Real-type, cf. State
+ * @param angleErrs Samples of the rotation errors, at most V::width, every sample has 15 errors
+ * @return std::array<std::vector<V>, 15> Unitaries for the rotations in line-form
+ */
+template<class V, class R>
+std::array<std::vector<V>, 15> genRotationsBasic(const std::vector<std::vector<R>>& angleErrs){
+    std::array<std::vector<V>, 15> Ops;
+    std::vector<V> U = {0, 0, 0, 0};
+    R emix, epix;
+    for (int i= 0;i<15;i++){
+        for (int l = 0; l<V::width; l++){
+            rotation(angleErrs[l%angleErrs.size()][i], i, emix, epix);
+            U[0][l] = emix;
+            U[1][l] = epix;
+            U[2][l] = epix;
+            U[3][l] = -emix;
+        }
+        Ops[i] = U;}
+    return Ops;
+}
+
+/**
+ * @brief Appends results to out, converted to R. Dual numbers append their derivatives after the values, cf. Dual.hpp.
+ *
+ * @tparam R Real number type of the output
+ * @tparam T Type of the results
+ * @param x Results
+ * @param out Output: the results are appended
+ */
+template<class R, class T>
+inline void toReals(const std::vector<T>& x, std::vector<R>& out){
+    for (const T& v : x)
+        out.push_back((R) v);
+}
+
 /**
  * @brief Writes the results of the simulation to a file
  * 
  * @tparam R Real number type that should be used, e.g. float.
+ * @tparam O Type of the overlap, R or an already formatted field
  * @param LossPositions Positions of loss in the circuit
  * @param doublePrep Spatial&Polarization modes with two-photon preparation
  * @param angleErrs Rotation error for wave plated
@@ -64,8 +120,8 @@ std::array<std::vector<V>, 15> genRotationsBasic(const std::vector<R>& angleErrs
  * @param rank Rank of the process, used for saving
  * @param res Result of the simulation
  */
-template<class R>
-inline void write(const std::vector<int>& LossPositions, const std::vector<int>& doublePrep, const std::vector<R>& angleErrs, const R& ovl, const std::string& path, int rank, const std::vector<R>& res){
+template<class R, class O>
+inline void write(const std::vector<int>& LossPositions, const std::vector<int>& doublePrep, const std::vector<R>& angleErrs, const O& ovl, const std::string& path, int rank, const std::vector<R>& res){
 	std::ostringstream sstream;
 	std::ofstream myfile;
 	sstream << ovl << " ";
@@ -83,6 +139,26 @@ inline void write(const std::vector<int>& LossPositions, const std::vector<int>&
 	myfile.close();
 }
 
+/**
+ * @brief Writes the results of the simulation for an overlap matrix to a file. The upper triangle of the matrix is written instead of the pairwise overlap, cf. write().
+ * 
+ * @tparam R Real number type that should be used, e.g. float.
+ * @param LossPositions Positions of loss in the circuit
+ * @param doublePrep Spatial&Polarization modes with two-photon preparation
+ * @param angleErrs Rotation error for wave plated
+ * @param G Matrix of pairwise overlaps of the wave functions
+ * @param path Path-prefix where to save
+ * @param rank Rank of the process, used for saving
+ * @param res Result of the simulation
+ */
+template<class R>
+inline void write(const std::vector<int>& LossPositions, const std::vector<int>& doublePrep, const std::vector<R>& angleErrs, const std::vector<std::vector<R>>& G, const std::string& path, int rank, const std::vector<R>& res){
+	std::ostringstream sstream;
+	for (size_t i = 0; i<G.size(); i++)
+		for (size_t j = i+1; j<G[i].size(); j++) sstream << G[i][j] << "|";
+	write(LossPositions, doublePrep, angleErrs, sstream.str(), path, rank, res);
+}
+
 /**
  * @brief Given to float-vectors that parametrize wave functions, it returs the overlap, which is trivially saved in the first vector.
  * 
@@ -96,6 +172,115 @@ float trivOvlF(const std::vector<float>& V, const std::vector<float>& W){
     return 1.0;
 }
 
+/**
+ * @brief Same as trivOvlF() for general amplitude and real types.
+ * 
+ * @tparam V Value-type, cf. State
+ * @tparam R Real-type, cf. State
+ * @param A First vector, at least len 2 with identifier on 0 and overlap on 1
+ * @param B Second vector, at least len 1 with identifier on 0
+ * @return V Overlap of the wave functions
+ */
+template<class V, class R>
+V trivOvl(const std::vector<R>& A, const std::vector<R>& B){
+    if (A[0]!= B[0]) 
+        return (V) A[1]; 
+    return (V) 1.0;
+}
+
+/**
+ * @brief Closed form of the Gram-Schmidt procedure in State::addBasisElem() for wave functions with uniform pairwise overlap ovl, cf. trivOvlF().
+ * 
+ * @tparam R Real-type, cf. State
+ * @param n Index of the photon
+ * @param k Index of the orthogonal Distinguishability mode, k<=n
+ * @param ovl Pairwise overlap
+ * @return R Amplitude of the wave function of photon n for the orthogonal Distinguishability mode k. For k<n it does not depend on n.
+ */
+template<class R>
+R gsCoeff(int n, int k, const R& ovl){
+    if (k == 0)
+        return (n == 0) ? (R) 1.0 : ovl;
+    if (k == n)
+        return std::sqrt((1-ovl)*(1+n*ovl)/(1+(n-1)*ovl));
+    return ovl*std::sqrt((1-ovl)/((1+(k-1)*ovl)*(1+k*ovl)));
+}
+
+/**
+ * @brief Gram-Schmidt procedure of State::addBasisElem() for a general overlap matrix, i.e. its Cholesky decomposition G = L L^T.
+ * 
+ * @tparam R Real-type, cf. State
+ * @param G Symmetric matrix of pairwise overlaps with G[i][i] = 1, the order of the rows is the order in which the photons are added.
+ * @return std::vector<std::vector<R>> L, where L[n][k] is the amplitude of the wave function of photon n for the orthogonal Distinguishability mode k<=n.
+ */
+template<class R>
+std::vector<std::vector<R>> gsMatrix(const std::vector<std::vector<R>>& G){
+    int n = G.size();
+    std::vector<std::vector<R>> L(n, std::vector<R>(n, 0.0));
+    R v;
+    for (int i = 0; i<n; i++){
+        for (int k = 0; k<=i; k++){
+            v = G[i][k];
+            for (int j = 0; j<k; j++)
+                v -= L[i][j]*L[k][j];
+            if (k == i)
+                L[i][i] = (v > 0) ? std::sqrt(v) : (R) 0.0;
+            else
+                L[i][k] = (L[k][k] != 0) ? v/L[k][k] : (R) 0.0;
+        }
+    }
+    return L;
+}
+
+/**
+ * @brief Uniform overlap matrix, i.e. all distinct wave functions have the overlap ovl, cf. trivOvlF().
+ * 
+ * @tparam R Real-type, cf. State
+ * @param n Number of wave functions
+ * @param ovl Pairwise overlap
+ * @return std::vector<std::vector<R>> The overlap matrix
+ */
+template<class R>
+std::vector<std::vector<R>> ovlMatrix(int n, const R& ovl){
+    std::vector<std::vector<R>> G(n, std::vector<R>(n, ovl));
+    for (int i = 0; i<n; i++) G[i][i] = 1.0;
+    return G;
+}
+
+/**
+ * @brief Inverse of the cumulative distribution function of the standard normal distribution, by bisection on std::erfc(), e.g. to map uniform samples
+ * to normally distributed rotation errors.
+ * 
+ * @param u Probability, between 0 and 1
+ * @return double x with P(X < x) = u for a standard normal X
+ */
+inline double invNormal(double u){
+    double a = -40, b = 40, x;
+    for (int i = 0; i<80; i++){
+        x = (a+b)/2;
+        if (0.5*std::erfc(-x/std::sqrt(2.0)) < u) a = x;
+        else b = x;
+    }
+    return (a+b)/2;
+}
+
+/**
+ * @brief Generators of the additive quasi-random sequence in d dimensions, frac(n*alpha) for n = 1, 2, ..., with alpha_j = phi^-(j+1) for the
+ * positive root phi of x^(d+1) = x+1. Points of different random shifts (mod 1) are independent randomizations of the sequence.
+ * 
+ * @param d Number of dimensions
+ * @return std::vector<double> alpha
+ */
+inline std::vector<double> quasiAlpha(size_t d){
+    double phi = 2;
+    for (int i = 0; i<100; i++)
+        phi = std::pow(1+phi, 1.0/(d+1));
+    std::vector<double> alpha(d);
+    for (size_t j = 0; j<d; j++)
+        alpha[j] = std::fmod(std::pow(1/phi, j+1), 1.0);
+    return alpha;
+}
+
 /**
  * @brief Applies loss on modes in S if the current position pos is in lossPos
  * 
@@ -24,195 +24,1577 @@ DEALINGS IN THE SOFTWARE.
 #include "State.hpp"
 #include "Key.hpp"
 #include "simAux.hpp"
+#include "FidPoly.hpp"
+#include "FidCheb.hpp"
+#include "BlockState.hpp"
 #include <iomanip>
+#include <functional>
+#include <tuple>
+#include <queue>
+#include <random>
+#include <map>
 
+/**
+ * @brief Phase of the GHZ state that is heralded by the measurement outcome p4+2*p2+4*p1, cf. fidsim().
+ * 
+ */
+const int GHZPHASE[8] = {1, -1, -1, 1, -1, 1, 1, -1};
+
+/**
+ * @brief Number of chunks of consecutive configurations in fidAccumulate(). The chunks are processed in parallel and combined by pairwiseReduce(),
+ * such that the results depend on this number but not on the number of threads. Every chunk holds its own accumulators.
+ * 
+ */
+const size_t FID_CHUNKS = 16;
 
+/**
+ * @brief Cleans input such that only the keys with the same DMode in one of the parts of the GHZ state remain.
+ * 
+ * @tparam K Key-type, cf. State
+ * @tparam V Value-type, cf. State
+ * @tparam R Real-type, cf. State
+ * @param S State to compute to overlap for
+ * @param a phase for GHZ state - either 1 or -1
+ */
+template<class K, class V, class R>
+inline void cleanOvlGHZ(State<K, V, R>& S, int a){
+    V f = (R) (1.0/std::sqrt(2)), f2 = ((V) (R) a)*f;
+    S.sameDModeDel({{0, 6, 10}, {1, 7, 11}}, {f, f2}); //Projection where all 
+}
 
+/**
+ * @brief Amplitudes of the 6-photon reference state for the pairwise overlap ovl.
+ * 
+ * The order of the amplitudes is the order of the keys, i.e. the same order as the input combinations of DModes in fidsim().
+ * 
+ * @tparam K Key-type, cf. State
+ * @tparam V Value-type, cf. State
+ * @tparam R Real-type, cf. State
+ * @param ovl Pairwise overlap
+ * @return std::vector<V> One amplitude for every input combination of DModes
+ */
+template<class K, class V, class R>
+inline std::vector<V> fidRef(const R& ovl){
+    State<K, V, R> S;
+    S.set(&trivOvl<V, R>);
+    S.set((R) std::pow(10, -8));
+    for (int i=0; i<6; i++){
+            S.addPhoton({(R) i, ovl}, 2*i, 1);
+    }
+    std::vector<V> amps;
+    for (typename State<K, V, R>::iterator it = S.begin(); it!=S.end();it++)
+        amps.push_back(it->second);
+    return amps;
+}
+
+/**
+ * @brief Amplitudes of the reference states for several overlaps, transposed such that the amplitudes of one input combination of DModes are contiguous.
+ * 
+ * @tparam K Key-type, cf. State
+ * @tparam V Value-type, cf. State
+ * @tparam R Real-type, cf. State
+ * @param ovls Pairwise overlaps
+ * @param size Number of input combinations of DModes, the result has at least this many entries
+ * @return std::vector<std::vector<V>> For every input combination of DModes one amplitude per overlap. Keys that are missing in a reference (e.g. for ovl = 1)
+ * and entries beyond all references are padded with amplitude 0.
+ */
+template<class K, class V, class R>
+inline std::vector<std::vector<V>> fidRefs(const std::vector<R>& ovls, size_t size = 0){
+    std::vector<std::vector<V>> refs, refsT;
+    size_t n = size;
+    for (R o : ovls){
+        refs.push_back(fidRef<K, V, R>(o));
+        n = std::max(n, refs.back().size());
+    }
+    refsT.assign(n, std::vector<V>(ovls.size(), 0.0));
+    for (size_t o=0; o<ovls.size(); o++)
+        for (size_t i=0; i<refs[o].size(); i++)
+            refsT[i][o] = refs[o][i];
+    return refsT;
+}
+
+/**
+ * @brief Projects the states after the measurement of one input combination of DModes onto the GHZ state (cf. cleanOvlGHZ()).
+ * 
+ * @tparam K Key-type, cf. State
+ * @tparam V Value-type, cf. State
+ * @tparam R Real-type, cf. State
+ * @param PreData Remaining states after the measurement, one for every measurement outcome
+ * @return std::array<State<K, V, R>, 8> The projected states
+ */
+template<class K, class V, class R>
+inline std::array<State<K, V, R>, 8> fidProject(const std::array<State<K, V, R>, 8>& PreData){
+    std::array<State<K, V, R>, 8> Proj = PreData;
+    for (int j = 0; j<8; j++)
+        cleanOvlGHZ(Proj[j], GHZPHASE[j]);
+    return Proj;
+}
+
+/**
+ * @brief Measurement outcome of a key, i.e. p4+2*p2+4*p1 read off the occupation of the measured modes 3, 5 and 9, cf. fidsim().
+ * 
+ * @tparam K Key-type, cf. State
+ * @param k Key that is accepted by one of the measurement outcomes
+ * @return int The measurement outcome
+ */
+template<class K>
+inline int outcome(const K& k){
+    int n3 = 0, n5 = 0, n9 = 0;
+    for (typename K::const_iterator it = k.cbegin(); it != k.cend(); it++){
+        if (it->first.first == 3) n3 += it->second;
+        else if (it->first.first == 5) n5 += it->second;
+        else if (it->first.first == 9) n9 += it->second;
+    }
+    return 4*n3+2*n5+n9;
+}
+
+/**
+ * @brief Folds the states of the 8 measurement outcomes onto a common Pauli frame and adds them to one State.
+ * 
+ * The outcomes only differ in the phase of the heralded GHZ state, which is corrected by a phase flip on mode 1. As the outcomes have different
+ * occupations of the measured modes, the folded parts stay orthogonal and can be separated again using outcome().
+ * 
+ * @tparam K Key-type, cf. State
+ * @tparam V Value-type, cf. State
+ * @tparam R Real-type, cf. State
+ * @param SVec States for the measurement outcomes
+ * @return State<K, V, R> Folded State, its projection onto the GHZ state uses the phase 1
+ */
+template<class K, class V, class R>
+inline State<K, V, R> foldOutcomes(const std::array<State<K, V, R>, 8>& SVec){
+    State<K, V, R> S, S2;
+    for (int j = 0; j<8; j++){
+        S2 = SVec[j];
+        if (GHZPHASE[j] == -1)
+            S2.apply((V) -1.0, 1);
+        S.add(S2);
+    }
+    return S;
+}
+
+/**
+ * @brief Folds one input combination of DModes into the accumulators of fid().
+ * 
+ * @tparam K Key-type, cf. State
+ * @tparam V Value-type, cf. State
+ * @tparam R Real-type, cf. State
+ * @param Proj States after the measurement projected onto the GHZ state, cf. fidProject()
+ * @param PreData Remaining states after the measurement
+ * @param Compl Complement of the states after the measurement
+ * @param amp Amplitude of the input combination in the reference state, cf. fidRef()
+ * @param StV Accumulator for the overlap with the GHZ state
+ * @param StV2 Accumulator for the accepted states, used for normalization
+ */
+template<class K, class V, class R>
+inline void fidAdd(const std::array<State<K, V, R>, 8>& Proj, const std::array<State<K, V, R>, 8>& PreData, const std::array<State<K, V, R>, 8>& Compl, const V& amp, std::array<State<K, V, R>, 8>& StV, std::array<State<K, V, R>, 8>& StV2){
+    for (int j = 0; j<8; j++){
+        StV[j].add(Proj[j], amp);
+        StV2[j].add(PreData[j], amp);
+        StV2[j].add(Compl[j], amp);}
+}
+
+/**
+ * @brief Computes the probabilities and fidelities from the accumulators of fid() and writes them to a file.
+ * 
+ * @tparam K Key-type, cf. State
+ * @tparam V Value-type, cf. State
+ * @tparam R Real-type, cf. State
+ * @param StV Accumulator for the overlap with the GHZ state
+ * @param StV2 Accumulator for the accepted states
+ * @param ovl Pairwise overlap
+ * @param angErrs Angle errors in the setup
+ * @param doublePrep Events/positions of double-preparation
+ * @param lossPos Events/positions of loss
+ * @param path The path to the folder where the data should be saves.
+ * @param rank The rank of the current process. Used for saving the data to the file.
+ */
+template<class K, class V, class R>
+inline void fidWrite(const std::array<State<K, V, R>, 8>& StV, const std::array<State<K, V, R>, 8>& StV2, const R& ovl, const std::vector<R>& angErrs, const std::vector<int>& doublePrep, const std::vector<int>& lossPos, const std::string& path, int rank){
+    std::vector<R> res;
+    for (int i=0; i<8; i++) {
+        res.push_back(StV2[i].normSq());
+        res.push_back(StV[i].normSq()/StV2[i].normSq());}
+    write(lossPos, doublePrep, angErrs, ovl, path, rank, res);
+}
+
+/**
+ * @brief Computes the fidelity for pre-computed data and writes it to a file.
+ * 
+ * @tparam K Key-type, cf. State
+ * @tparam V Value-type, cf. State
+ * @tparam R Real-type, cf. State
+ * @param PreData Vector of Arrays (one for every input combination of DModes) of the remaining states after the measurement already projected onto the spatial and polarization modes of the GHZ state
+ * @param Compl Same data structure as PreData. These contains the complement of the states after the measurement, i.e. those parts orthogonal to the GHZ state.
+ * @param ovl Pairwise overlap
+ * @param angErrs Angle errors in the setup
+ * @param doublePrep Events/positions of double-preparation
+ * @param lossPos Events/positions of loss
+ * @param path The path to the folder where the data should be saves.
+ * @param rank The rank of the current process. Used for saving the data to the file.
+ */
+template<class K, class V, class R>
+inline void fid(const std::vector<std::array<State<K, V, R>, 8>>& PreData, const std::vector<std::array<State<K, V, R>, 8>>& Compl, const R& ovl, const std::vector<R>& angErrs, const std::vector<int>& doublePrep, const std::vector<int>& lossPos, const std::string& path, int rank){
+    std::array<State<K, V, R>, 8> StV, StV2;
+    std::vector<V> amps = fidRef<K, V, R>(ovl);
+    for (size_t i=0; i<amps.size(); i++)
+        fidAdd(fidProject(PreData[i]), PreData[i], Compl[i], amps[i], StV, StV2);
+    fidWrite(StV, StV2, ovl, angErrs, doublePrep, lossPos, path, rank);
+}
+
+/**
+ * @brief Accumulator with one amplitude lane per overlap. The lanes of a key are stored contiguously, such that the update of all overlaps is one vectorizable loop.
+ * 
+ * @tparam K Key-type, cf. State
+ * @tparam V Value-type, cf. State
+ * @tparam R Real-type, cf. State
+ */
+template<class K, class V, class R>
+class LaneAcc{
+    /**
+     * @brief Maps the keys to their position in amps.
+     * 
+     */
+    boost::container::flat_map<K, int> index;
+
+    /**
+     * @brief The amplitudes, the lanes of key k are amps[index[k]*lanes, (index[k]+1)*lanes). Accumulated in higher precision, cf. Accum.
+     * 
+     */
+    std::vector<accum_t<V>> amps;
+
+    /**
+     * @brief Number of lanes, i.e. overlaps.
+     * 
+     */
+    size_t lanes = 0;
+
+    public:
+
+        /**
+         * @brief Construct a new LaneAcc object.
+         * 
+         * @param n Number of lanes
+         */
+        LaneAcc(size_t n = 0){lanes = n;}
+
+        /**
+         * @brief Adds a State scaled with one amplitude per lane, i.e. lane l is increased by a[l]*S.
+         * 
+         * @tparam W Type of the lane amplitudes, e.g. V or a higher precision if the States are stored in reduced precision
+         * @param S State to add
+         * @param a Amplitudes, one per lane
+         */
+        template<class W>
+        inline void add(const State<K, V, R>& S, const std::vector<W>& a){
+            std::pair<typename boost::container::flat_map<K, int>::iterator, bool> pib;
+            accum_t<V> v;
+            accum_t<V>* dst;
+            const W* src = a.data();
+            for (typename State<K, V, R>::const_iterator it = S.cbegin(); it != S.cend(); it++){
+                pib = index.emplace(it->first, index.size());
+                if (pib.second)
+                    amps.resize(amps.size()+lanes, 0.0);
+                v = (accum_t<V>) it->second;
+                dst = amps.data()+pib.first->second*lanes;
+                axpy(dst, src, lanes, v);
+            }
+        }
+
+        /**
+         * @brief Adds the lanes of another accumulator, key by key.
+         * 
+         * @param o Accumulator to add, with the same number of lanes
+         */
+        inline void add(const LaneAcc<K, V, R>& o){
+            std::pair<typename boost::container::flat_map<K, int>::iterator, bool> pib;
+            accum_t<V>* dst;
+            const accum_t<V>* src;
+            for (typename boost::container::flat_map<K, int>::const_iterator it = o.index.cbegin(); it != o.index.cend(); it++){
+                pib = index.emplace(it->first, index.size());
+                if (pib.second)
+                    amps.resize(amps.size()+lanes, 0.0);
+                dst = amps.data()+pib.first->second*lanes;
+                src = o.amps.data()+it->second*lanes;
+                for (size_t l = 0; l<lanes; l++)
+                    dst[l] += src[l];
+            }
+        }
+
+        /**
+         * @brief Returns the squared norms of all lanes, cf. State::normSq(). The keys are summed in chunks of REDUCE_CHUNK in key order, cf. pairwiseReduce().
+         * 
+         * @return std::vector<sqnorm_t<V>> One squared norm per lane
+         */
+        inline std::vector<sqnorm_t<V>> normSq() const {
+            std::vector<std::vector<sqnorm_t<V>>> r = normSq([](const K&){return 0;}, 1);
+            return r[0];
+        }
+
+        /**
+         * @brief Returns the squared norms of all lanes, separately for groups of keys.
+         * 
+         * @tparam G Callable that maps a key to its group, i.e. a number between 0 and n-1
+         * @param group Maps a key to its group
+         * @param n Number of groups
+         * @return std::vector<std::vector<sqnorm_t<V>>> For every group one squared norm per lane
+         */
+        template<class G>
+        inline std::vector<std::vector<sqnorm_t<V>>> normSq(G group, int n) const {
+            size_t c = std::max((size_t) 1, (index.size()+REDUCE_CHUNK-1)/REDUCE_CHUNK);
+            std::vector<std::vector<std::vector<sqnorm_t<V>>>> part(c, std::vector<std::vector<sqnorm_t<V>>>(n, std::vector<sqnorm_t<V>>(lanes, 0.0)));
+            KERNEL_PARALLEL_FOR(c)
+            for (size_t k = 0; k<c; k++){
+                typename boost::container::flat_map<K, int>::const_iterator it = index.cbegin()+std::min(index.size(), k*REDUCE_CHUNK), e = index.cbegin()+std::min(index.size(), (k+1)*REDUCE_CHUNK);
+                for (; it != e; it++)
+                    addSq(part[k][group(it->first)].data(), amps.data()+it->second*lanes, lanes);
+            }
+            pairwiseReduce(part, [this, n](std::vector<std::vector<sqnorm_t<V>>>& a, std::vector<std::vector<sqnorm_t<V>>>& b){
+                for (int g = 0; g<n; g++)
+                    for (size_t l = 0; l<lanes; l++)
+                        a[g][l] += b[g][l];});
+            return part[0];
+        }
+};
+
+/**
+ * @brief Folds one input combination of DModes into the accumulators of fid() for all overlaps at once.
+ * 
+ * @tparam K Key-type, cf. State
+ * @tparam V Value-type, cf. State
+ * @tparam R Real-type, cf. State
+ * @param Proj States after the measurement projected onto the GHZ state, cf. fidProject()
+ * @param PreData Remaining states after the measurement
+ * @param Compl Complement of the states after the measurement
+ * @param amps Amplitudes of the input combination in the reference states, one per overlap
+ * @param StV Accumulator for the overlap with the GHZ state
+ * @param StV2 Accumulator for the accepted states, used for normalization
+ */
+template<class K, class V, class R>
+inline void fidAdd(const std::array<State<K, V, R>, 8>& Proj, const std::array<State<K, V, R>, 8>& PreData, const std::array<State<K, V, R>, 8>& Compl, const std::vector<V>& amps, std::array<LaneAcc<K, V, R>, 8>& StV, std::array<LaneAcc<K, V, R>, 8>& StV2){
+    for (int j = 0; j<8; j++){
+        StV[j].add(Proj[j], amps);
+        StV2[j].add(PreData[j], amps);
+        StV2[j].add(Compl[j], amps);}
+}
+
+/**
+ * @brief Folds one input combination of DModes into the accumulators of fidsim() for all overlaps at once, with all measurement outcomes folded into one State, cf. foldOutcomes().
+ * 
+ * @tparam K Key-type, cf. State
+ * @tparam V Value-type, cf. State
+ * @tparam R Real-type, cf. State
+ * @tparam W Type of the reference amplitudes, cf. LaneAcc::add()
+ * @param PreData Remaining states after the measurement, folded
+ * @param Compl Complement of the states after the measurement, folded
+ * @param amps Amplitudes of the input combination in the reference states, one per overlap
+ * @param StV Accumulator for the overlap with the GHZ state
+ * @param StV2 Accumulator for the accepted states, used for normalization
+ */
+template<class K, class V, class R, class W>
+inline void fidAdd(const State<K, V, R>& PreData, const State<K, V, R>& Compl, const std::vector<W>& amps, LaneAcc<K, V, R>& StV, LaneAcc<K, V, R>& StV2){
+    State<K, V, R> Proj = PreData;
+    cleanOvlGHZ(Proj, 1);
+    StV.add(Proj, amps);
+    StV2.add(PreData, amps);
+    StV2.add(Compl, amps);
+}
+
+/**
+ * @brief Computes the probabilities and fidelities for all overlaps from the accumulators of fid() and writes them to a file.
+ * 
+ * @tparam K Key-type, cf. State
+ * @tparam V Value-type, cf. State
+ * @tparam R Real-type, cf. State
+ * @param StV Accumulator for the overlap with the GHZ state
+ * @param StV2 Accumulator for the accepted states
+ * @param ovls Pairwise overlaps, one per lane
+ * @param angErrs Angle errors in the setup
+ * @param doublePrep Events/positions of double-preparation
+ * @param lossPos Events/positions of loss
+ * @param path The path to the folder where the data should be saves.
+ * @param rank The rank of the current process. Used for saving the data to the file.
+ */
+template<class K, class V, class R>
+inline void fidWrite(const std::array<LaneAcc<K, V, R>, 8>& StV, const std::array<LaneAcc<K, V, R>, 8>& StV2, const std::vector<R>& ovls, const std::vector<R>& angErrs, const std::vector<int>& doublePrep, const std::vector<int>& lossPos, const std::string& path, int rank){
+    std::array<std::vector<sqnorm_t<V>>, 8> n, n2;
+    for (int j=0; j<8; j++){
+        n[j] = StV[j].normSq();
+        n2[j] = StV2[j].normSq();
+    }
+    std::vector<R> res;
+    for (size_t o=0; o<ovls.size(); o++){
+        res.clear();
+        for (int i=0; i<8; i++) {
+            res.push_back((R) n2[i][o]);
+            res.push_back((R) (n[i][o]/n2[i][o]));}
+        write(lossPos, doublePrep, angErrs, ovls[o], path, rank, res);
+    }
+}
+
+/**
+ * @brief Computes the probabilities and fidelities for all overlaps from the folded accumulators of fidsim(), in the type of the squared norms (cf. sqnorm_t).
+ * The measurement outcomes are separated by outcome().
+ * 
+ * @tparam K Key-type, cf. State
+ * @tparam V Value-type, cf. State
+ * @tparam R Real-type, cf. State
+ * @param StV Accumulator for the overlap with the GHZ state
+ * @param StV2 Accumulator for the accepted states
+ * @param perOutcome If set, the probability and fidelity of every outcome are returned, otherwise the total probability and the fidelity of all accepted outcomes
+ * @return std::vector<std::vector<sqnorm_t<V>>> For every overlap the results in the order of write()
+ */
+template<class K, class V, class R>
+inline std::vector<std::vector<sqnorm_t<V>>> fidEntries(const LaneAcc<K, V, R>& StV, const LaneAcc<K, V, R>& StV2, bool perOutcome = true){
+    std::vector<std::vector<sqnorm_t<V>>> res;
+    if (!perOutcome){
+        std::vector<sqnorm_t<V>> n = StV.normSq(), n2 = StV2.normSq();
+        for (size_t o=0; o<n.size(); o++)
+            res.push_back({n2[o], n[o]/n2[o]});
+        return res;
+    }
+    std::vector<std::vector<sqnorm_t<V>>> n = StV.normSq(&outcome<K>, 8), n2 = StV2.normSq(&outcome<K>, 8);
+    res.resize(n[0].size());
+    for (size_t o=0; o<res.size(); o++)
+        for (int i=0; i<8; i++) {
+            res[o].push_back(n2[i][o]);
+            res[o].push_back(n[i][o]/n2[i][o]);}
+    return res;
+}
+
+/**
+ * @brief Computes the probabilities and fidelities for all overlaps from the folded accumulators of fidsim(), cf. fidEntries().
+ * 
+ * @tparam K Key-type, cf. State
+ * @tparam V Value-type, cf. State
+ * @tparam R Real-type, cf. State
+ * @param StV Accumulator for the overlap with the GHZ state
+ * @param StV2 Accumulator for the accepted states
+ * @param perOutcome If set, the probability and fidelity of every outcome are returned, otherwise the total probability and the fidelity of all accepted outcomes
+ * @return std::vector<std::vector<R>> For every overlap the results in the order of write(), for Dual amplitudes followed by their derivatives (cf. toReals())
+ */
+template<class K, class V, class R>
+inline std::vector<std::vector<R>> fidResults(const LaneAcc<K, V, R>& StV, const LaneAcc<K, V, R>& StV2, bool perOutcome = true){
+    std::vector<std::vector<sqnorm_t<V>>> e = fidEntries(StV, StV2, perOutcome);
+    std::vector<std::vector<R>> res(e.size());
+    for (size_t o=0; o<e.size(); o++)
+        toReals(e[o], res[o]);
+    return res;
+}
+
+/**
+ * @brief Computes the probabilities and fidelities for all overlaps from the folded accumulators of fidsim() and writes them to a file, cf. fidResults().
+ * 
+ * @tparam K Key-type, cf. State
+ * @tparam V Value-type, cf. State
+ * @tparam R Real-type, cf. State
+ * @param StV Accumulator for the overlap with the GHZ state
+ * @param StV2 Accumulator for the accepted states
+ * @param ovls Pairwise overlaps, one per lane
+ * @param angErrs Angle errors in the setup
+ * @param doublePrep Events/positions of double-preparation
+ * @param lossPos Events/positions of loss
+ * @param path The path to the folder where the data should be saves.
+ * @param rank The rank of the current process. Used for saving the data to the file.
+ * @param perOutcome If set, the probability and fidelity of every outcome are written, otherwise the total probability and the fidelity of all accepted outcomes
+ */
+template<class K, class V, class R>
+inline void fidWrite(const LaneAcc<K, V, R>& StV, const LaneAcc<K, V, R>& StV2, const std::vector<R>& ovls, const std::vector<R>& angErrs, const std::vector<int>& doublePrep, const std::vector<int>& lossPos, const std::string& path, int rank, bool perOutcome = true){
+    std::vector<std::vector<R>> res = fidResults(StV, StV2, perOutcome);
+    for (size_t o=0; o<ovls.size(); o++)
+        write(lossPos, doublePrep, angErrs, ovls[o], path, rank, res[o]);
+}
+
+/**
+ * @brief Computes the fidelity for pre-computed data for all overlaps in one pass and writes it to a file.
+ * 
+ * @tparam K Key-type, cf. State
+ * @tparam V Value-type, cf. State
+ * @tparam R Real-type, cf. State
+ * @param PreData Vector of Arrays (one for every input combination of DModes) of the remaining states after the measurement already projected onto the spatial and polarization modes of the GHZ state
+ * @param Compl Same data structure as PreData. These contains the complement of the states after the measurement, i.e. those parts orthogonal to the GHZ state.
+ * @param ovls Pairwise overlaps
+ * @param angErrs Angle errors in the setup
+ * @param doublePrep Events/positions of double-preparation
+ * @param lossPos Events/positions of loss
+ * @param path The path to the folder where the data should be saves.
+ * @param rank The rank of the current process. Used for saving the data to the file.
+ */
+template<class K, class V, class R>
+inline void fid(const std::vector<std::array<State<K, V, R>, 8>>& PreData, const std::vector<std::array<State<K, V, R>, 8>>& Compl, const std::vector<R>& ovls, const std::vector<R>& angErrs, const std::vector<int>& doublePrep, const std::vector<int>& lossPos, const std::string& path, int rank){
+    std::array<LaneAcc<K, V, R>, 8> StV, StV2;
+    for (int j=0; j<8; j++) {StV[j] = LaneAcc<K, V, R>(ovls.size()); StV2[j] = LaneAcc<K, V, R>(ovls.size());}
+    std::vector<std::vector<V>> refs = fidRefs<K, V, R>(ovls, PreData.size());
+    for (size_t i=0; i<PreData.size(); i++)
+        fidAdd(fidProject(PreData[i]), PreData[i], Compl[i], refs[i], StV, StV2);
+    fidWrite(StV, StV2, ovls, angErrs, doublePrep, lossPos, path, rank);
+}
+
+/**
+ * @brief Kinds of steps of the circuit, cf. CircuitStep.
+ *
+ */
+enum CircuitOp{circuitLoss, circuitRotation, circuitSwap};
+
+/**
+ * @brief One step of the circuit of circuitFid().
+ *
+ */
+struct CircuitStep{
+    /**
+     * @brief Kind of the step.
+     *
+     */
+    CircuitOp op;
+
+    /**
+     * @brief Position of the loss for circuitLoss, index of the wave plate in apl for circuitRotation.
+     *
+     */
+    int arg;
+
+    /**
+     * @brief Affected modes, the two swapped modes for circuitSwap.
+     *
+     */
+    std::vector<int> modes;
+};
+
+/**
+ * @brief The steps of the photonic circuit we considered to create a GHZ state, in order, cf. circuitFid().
+ *
+ * @return const std::vector<CircuitStep>& The steps
+ */
+inline const std::vector<CircuitStep>& circuitSteps(){
+    static const std::vector<CircuitStep> steps = [](){
+        std::vector<CircuitStep> c;
+        for (int i=0; i<6; i++) c.push_back({circuitLoss, i, {2*i}});
+        for (int i=0; i<6; i++) c.push_back({circuitLoss, i+6, {2*i}});
+        for (int i=0; i<6; i++) c.push_back({circuitRotation, i, {2*i, 2*i+1}});
+        for (int i=0; i<6; i++) c.push_back({circuitLoss, i+12, {2*i, 2*i+1}});
+        for (int i=0; i<3; i++) c.push_back({circuitSwap, 0, {4*i+1, 4*i+3}});
+        for (int i=0; i<6; i++) c.push_back({circuitLoss, i+18, {2*i, 2*i+1}});
+        for (int i=0; i<6; i++) c.push_back({circuitRotation, i+6, {2*i, 2*i+1}});
+        c.push_back({circuitLoss, 24, {2, 3}});
+        c.push_back({circuitLoss, 25, {4, 5}});
+        c.push_back({circuitSwap, 0, {3, 5}});
+        c.push_back({circuitLoss, 26, {4, 5}});
+        c.push_back({circuitLoss, 27, {8, 9}});
+        c.push_back({circuitSwap, 0, {5, 9}});
+        c.push_back({circuitLoss, 28, {2, 3}});
+        c.push_back({circuitLoss, 29, {4, 5}});
+        c.push_back({circuitLoss, 30, {8, 9}});
+        c.push_back({circuitRotation, 12, {2, 3}});
+        c.push_back({circuitRotation, 13, {4, 5}});
+        c.push_back({circuitRotation, 14, {8, 9}});
+        c.push_back({circuitLoss, 32, {2, 3}});
+        c.push_back({circuitLoss, 33, {4, 5}});
+        c.push_back({circuitLoss, 35, {8, 9}});
+        return c;}();
+    return steps;
+}
+
+/**
+ * @brief Step of the circuit at which loss at position pos happens, cf. circuitSteps().
+ *
+ * @param pos Position of loss
+ * @return int Index of the step, -1 if there is no loss at pos in the circuit
+ */
+inline int lossStep(int pos){
+    const std::vector<CircuitStep>& c = circuitSteps();
+    for (int s = 0; s<(int) c.size(); s++)
+        if (c[s].op == circuitLoss && c[s].arg == pos) return s;
+    return -1;
+}
+
+/**
+ * @brief Classes of equivalent losses: two loss steps on the same modes are equivalent if all steps between them either act on other modes or are
+ * losses on the same modes, i.e. the loss commutes to the earlier step. Positions without a step in the circuit are no-ops, cf. lossStep().
+ *
+ * @return const std::vector<int>& For every step of circuitSteps() the earliest equivalent loss step, -1 for steps that are no loss
+ */
+inline const std::vector<int>& lossClasses(){
+    static const std::vector<int> rep = [](){
+        const std::vector<CircuitStep>& c = circuitSteps();
+        std::vector<int> r(c.size(), -1);
+        for (int s = 0; s<(int) c.size(); s++){
+            if (c[s].op != circuitLoss) continue;
+            r[s] = s;
+            for (int t = s-1; t>=0; t--){
+                bool touch = false;
+                for (int m : c[t].modes)
+                    touch = touch || std::find(c[s].modes.cbegin(), c[s].modes.cend(), m) != c[s].modes.cend();
+                if (!touch) continue;
+                if (c[t].op == circuitLoss && c[t].modes == c[s].modes) r[s] = r[t];
+                break;
+            }
+        }
+        return r;}();
+    return rep;
+}
+
+/**
+ * @brief Canonical form of the loss positions of a scenario, cf. lossClasses(). Positions without loss in the circuit are dropped and the losses of every
+ * class are moved to its earliest steps, such that equivalent scenarios have the same canonical form.
+ *
+ * @param lossPos Positions where loss happens
+ * @return std::vector<int> Sorted canonical positions
+ */
+inline std::vector<int> canonicalLoss(const std::vector<int>& lossPos){
+    const std::vector<CircuitStep>& c = circuitSteps();
+    const std::vector<int>& rep = lossClasses();
+    std::vector<int> cnt(c.size(), 0), r;
+    std::vector<bool> seen(c.size(), false);
+    for (int p : lossPos){
+        int s = lossStep(p);
+        if (s >= 0 && !seen[s]){ //a position listed twice is lost once, cf. detloss()
+            seen[s] = true;
+            cnt[rep[s]]++;
+        }
+    }
+    for (int s = 0; s<(int) c.size(); s++)
+        if (rep[s] >= 0 && cnt[rep[s]] > 0){
+            cnt[rep[s]]--;
+            r.push_back(c[s].arg);
+        }
+    std::sort(r.begin(), r.end());
+    return r;
+}
+
+/**
+ * @brief First step of the circuit that applies a rotation, cf. circuitSteps(). The steps before it do not depend on the rotation errors.
+ *
+ * @return int Index of the step
+ */
+inline int firstRotationStep(){
+    const std::vector<CircuitStep>& c = circuitSteps();
+    int s = 0;
+    while (s<(int) c.size() && c[s].op != circuitRotation) s++;
+    return s;
+}
+
+/**
+ * @brief The photonic circuit we considered to create a GHZ state, cf. circuitSteps(). Only the steps in [first, last) are performed, such that
+ * the circuit can be resumed from a State after a prefix of it.
+ * 
+ * @tparam K Key-type, cf. State
+ * @tparam V Value-type, cf. State
+ * @tparam R Real-type, cf. State
+ * @param S State to perform the circuit on.
+ * @param lossPos Positions where loss happens
+ * @param apl Rotations as unitaries repr. as single line unitaries 
+ * @param first First step that is performed
+ * @param last End of the performed steps, -1 for the end of the circuit
+ */
+template<class K, class V, class R>
+inline void circuitFid(State<K, V, R>& S, const std::vector<int>& lossPos, const std::array<std::vector<V>, 15>& apl, int first = 0, int last = -1){
+    const std::vector<CircuitStep>& c = circuitSteps();
+    if (last < 0) last = c.size();
+    for (int s = first; s<last; s++){
+        if (c[s].op == circuitLoss) detloss(S, c[s].arg, c[s].modes, lossPos);
+        else if (c[s].op == circuitRotation) S.apply(apl[c[s].arg], c[s].modes);
+        else S.swap(c[s].modes[0], c[s].modes[1]);
+    }
+}
+
+/**
+ * @brief Maps a the perfectly distinguishable configuration to a partially distinguishability conf.
+ * 
+ * @tparam K Key-type, cf. State
+ * @tparam V Value-type, cf. State
+ * @tparam R Real-type, cf. State
+ * @param conf Key that encodes the desired distinguishability configuration
+ * @param SVec States that should be used for the result, completly overlapping with GHZ in spatial and polarization and acceptable measurement results.
+ * @param comp States that are used for normalization, i.e. part of the measurement result but orthogonal to GHZ, as map is not norm preserving
+ * @param S Part of the state that is orthogonal to all acceptable measurement results
+ */
+template<class K, class V, class R>
+void collapseRenorm(const K& conf, std::array<State<K, V, R>, 8>& SVec, std::array<State<K, V, R>, 8>& comp, State<K, V, R>& S){
+    sqnorm_t<V> n=0.0;
+    V f;
+    using std::sqrt;
+    for (int i = 0; i<8; i++){
+        SVec[i].collapse(conf);
+        comp[i].collapse(conf);
+        n += SVec[i].normSq();
+        n += comp[i].normSq();
+    }
+    S.collapse(conf);
+    n += S.normSq();
+    if (n!=0.0){
+    f = (V) (1/sqrt(n));
+    for (int i = 0; i<8; i++){
+        SVec[i].mul(f);
+        comp[i].mul(f);
+    }}
+}
+
+/**
+ * @brief Maps a the perfectly distinguishable configuration to a partially distinguishability conf. Same as above, but the part orthogonal to all acceptable measurement results is kept in the block layout.
+ * 
+ * @tparam K Key-type, cf. State
+ * @tparam V Value-type, cf. State
+ * @tparam R Real-type, cf. State
+ * @param conf Key that encodes the desired distinguishability configuration
+ * @param SVec States that should be used for the result, completly overlapping with GHZ in spatial and polarization and acceptable measurement results.
+ * @param comp States that are used for normalization, i.e. part of the measurement result but orthogonal to GHZ, as map is not norm preserving
+ * @param S Part of the state that is orthogonal to all acceptable measurement results
+ */
+template<class K, class V, class R>
+void collapseRenorm(const K& conf, std::array<State<K, V, R>, 8>& SVec, std::array<State<K, V, R>, 8>& comp, BlockState<K, V, R>& S){
+    sqnorm_t<V> n=0.0;
+    V f;
+    using std::sqrt;
+    for (int i = 0; i<8; i++){
+        SVec[i].collapse(conf);
+        comp[i].collapse(conf);
+        n += SVec[i].normSq();
+        n += comp[i].normSq();
+    }
+    S.collapse(conf);
+    n += S.normSq();
+    if (n!=0.0){
+    f = (V) (1/sqrt(n));
+    for (int i = 0; i<8; i++){
+        SVec[i].mul(f);
+        comp[i].mul(f);
+    }}
+}
+
+/**
+ * @brief Maps a the perfectly distinguishable configuration to a partially distinguishability conf. Same as above, but for the folded measurement outcomes, cf. foldOutcomes().
+ * 
+ * @tparam K Key-type, cf. State
+ * @tparam V Value-type, cf. State
+ * @tparam R Real-type, cf. State
+ * @param conf Key that encodes the desired distinguishability configuration
+ * @param SAgg Folded states that should be used for the result, completly overlapping with GHZ in spatial and polarization and acceptable measurement results.
+ * @param comp Folded states that are used for normalization, i.e. part of the measurement result but orthogonal to GHZ, as map is not norm preserving
+ * @param S Part of the state that is orthogonal to all acceptable measurement results
+ */
+template<class K, class V, class R>
+void collapseRenorm(const K& conf, State<K, V, R>& SAgg, State<K, V, R>& comp, BlockState<K, V, R>& S){
+    sqnorm_t<V> n=0.0;
+    V f;
+    using std::sqrt;
+    SAgg.collapse(conf);
+    comp.collapse(conf);
+    n += SAgg.normSq();
+    n += comp.normSq();
+    S.collapse(conf);
+    n += S.normSq();
+    if (n!=0.0){
+    f = (V) (1/sqrt(n));
+    SAgg.mul(f);
+    comp.mul(f);
+    }
+}
+
+/**
+ * @brief Static check whether a scenario can produce an accepted event, without simulating it. The photon numbers are bounded on blocks of modes:
+ * rotations merge the blocks of their modes, swaps relabel them and a loss removes at most one photon from the blocks it touches, exactly one if
+ * they are contained in its modes and not empty. An accepted event (cf. fidSplit()) has exactly one photon in every measured pair of modes and at
+ * least one in every output pair, which is checked for every union of blocks. If this fails, all probabilities of the scenario are 0.
+ * 
+ * @param doublePrep Spatial modes with two-photon preparation
+ * @param lossPos Positions where loss happens
+ * @return bool false if the scenario provably has no accepted event
+ */
+inline bool fidFeasible(const std::vector<int>& doublePrep, const std::vector<int>& lossPos){
+    const std::vector<CircuitStep>& c = circuitSteps();
+    const std::vector<int> measured = {2, 3, 4, 5, 8, 9};
+    std::vector<int> blk(12), lo(12), hi(12), ids;
+    for (int m = 0; m<12; m++){
+        blk[m] = m;
+        lo[m] = (m%2 == 0) ? 1+(std::find(doublePrep.cbegin(), doublePrep.cend(), m/2) != doublePrep.cend()) : 0;
+        hi[m] = lo[m];
+    }
+    auto merge = [&blk, &lo, &hi, &ids](const std::vector<int>& modes){ //merges the blocks touching modes into one, returns whether they are contained in modes
+        ids.clear();
+        for (int m : modes)
+            if (std::find(ids.cbegin(), ids.cend(), blk[m]) == ids.cend()) ids.push_back(blk[m]);
+        for (size_t k = 1; k<ids.size(); k++){
+            lo[ids[0]] += lo[ids[k]];
+            hi[ids[0]] += hi[ids[k]];
+        }
+        bool contained = true;
+        for (int m = 0; m<12; m++)
+            if (std::find(ids.cbegin(), ids.cend(), blk[m]) != ids.cend()){
+                blk[m] = ids[0];
+                contained = contained && std::find(modes.cbegin(), modes.cend(), m) != modes.cend();
+            }
+        return contained;
+    };
+    bool contained;
+    int b;
+    for (const CircuitStep& st : c){
+        if (st.op == circuitRotation) merge(st.modes);
+        else if (st.op == circuitSwap) std::swap(blk[st.modes[0]], blk[st.modes[1]]);
+        else if (std::find(lossPos.cbegin(), lossPos.cend(), st.arg) != lossPos.cend()){
+            contained = merge(st.modes);
+            b = blk[st.modes[0]];
+            lo[b] = std::max(lo[b]-1, 0);
+            if (contained) hi[b] = std::max(hi[b]-1, 0);
+        }
+        for (int m = 0; m<12; m++) //every mode of an empty block is empty, separate blocks keep them out of later merges
+            if (hi[blk[m]] == 0){
+                blk[m] = lo.size();
+                lo.push_back(0);
+                hi.push_back(0);
+            }
+    }
+    ids.clear();
+    for (int m = 0; m<12; m++)
+        if (std::find(ids.cbegin(), ids.cend(), blk[m]) == ids.cend()) ids.push_back(blk[m]);
+    std::vector<bool> in(12);
+    int l, h, full, touched;
+    bool meas;
+    for (unsigned mask = 1; mask < (1u << ids.size()); mask++){
+        l = 0;
+        h = 0;
+        for (size_t k = 0; k<ids.size(); k++)
+            if (mask & (1u << k)){
+                l += lo[ids[k]];
+                h += hi[ids[k]];
+            }
+        for (int m = 0; m<12; m++)
+            in[m] = (mask >> (std::find(ids.cbegin(), ids.cend(), blk[m])-ids.cbegin())) & 1u;
+        full = 0;
+        touched = 0;
+        meas = true;
+        for (int m = 0; m<12; m+=2){
+            full += in[m] && in[m+1];
+            touched += in[m] || in[m+1];
+            if ((in[m] || in[m+1]) && std::find(measured.cbegin(), measured.cend(), m) == measured.cend()) meas = false;
+        }
+        if (h < full || (meas && l > touched)) //every pair needs a photon, a measured pair exactly one
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Prepares the perfectly distinguishable input of the circuit, cf. fidPrepare().
+ * 
+ * @tparam K Key-type, cf. State
+ * @tparam V Value-type, cf. State
+ * @tparam R Real-type, cf. State
+ * @param doublePrep Spatial modes with two-photon preparation
+ * @param S Output: the input state
+ */
+template<class K, class V, class R>
+void fidInit(const std::vector<int>& doublePrep, State<K, V, R>& S){
+    S.set(12);
+    S.set(&trivOvl<V, R>);
+    for (int i=0; i<6; i++){
+        if (std::find(doublePrep.begin(), doublePrep.end(), i)!=doublePrep.end())
+            S.addPhoton({(R) i, 0.0}, 2*i, 2);
+        else
+            S.addPhoton({(R) i, 0.0}, 2*i, 1);
+    }
+}
+
+/**
+ * @brief Prepares the input and performs the circuit up to the first rotation (cf. firstRotationStep()), which does not depend on the rotation errors.
+ * The result is loaded from a snapshot in dir, if there is one for doublePrep and the losses before the first rotation, otherwise it is computed and
+ * saved there, such that runs with other rotation errors can resume from it. The snapshots are written with State::save() and depend on the Key and
+ * amplitude type.
+ * 
+ * @tparam K Key-type, cf. State
+ * @tparam V Value-type, cf. State
+ * @tparam R Real-type, cf. State
+ * @param doublePrep Spatial modes with two-photon preparation
+ * @param lossPos Positions where loss happens, only the ones before the first rotation in the canonical form (cf. canonicalLoss()) are performed
+ * @param S Output: the state before the first rotation
+ * @param dir Pathprefix of the snapshots
+ * @param rank Rank of the process (used for writing the snapshot)
+ * @return bool Whether the state was loaded from a snapshot
+ */
+template<class K, class V, class R>
+bool fidSnapshot(const std::vector<int>& doublePrep, const std::vector<int>& lossPos, State<K, V, R>& S, const std::string& dir, int rank){
+    std::vector<int> dp = doublePrep, lp;
+    int first = firstRotationStep();
+    std::sort(dp.begin(), dp.end());
+    dp.erase(std::unique(dp.begin(), dp.end()), dp.end());
+    for (int p : canonicalLoss(lossPos))
+        if (lossStep(p) < first) lp.push_back(p);
+    std::string name = dir+"snap";
+    for (int i : dp) name += "_"+std::to_string(i);
+    name += "-";
+    for (int i : lp) name += "_"+std::to_string(i);
+    name += "-"+std::to_string(sizeof(typename K::basetype))+"_"+std::to_string(sizeof(V))+".bin";
+    fidInit(dp, S);
+    std::ifstream infile(name, std::ios_base::binary);
+    if (infile && S.load(infile)) return true;
+    circuitFid(S, lp, std::array<std::vector<V>, 15>(), 0, first);
+    std::string tmp = name+".part"+std::to_string(rank);
+    std::ofstream outfile(tmp, std::ios_base::binary);
+    S.save(outfile);
+    outfile.close();
+    if (outfile) std::rename(tmp.c_str(), name.c_str()); //complete snapshots only, other processes may read name concurrently
+    else std::remove(tmp.c_str());
+    return false;
+}
+
+/**
+ * @brief Splits the output of the circuit according to the first measurement, cf. fidPrepare().
+ * 
+ * @tparam K Key-type, cf. State
+ * @tparam V Value-type, cf. State
+ * @tparam R Real-type, cf. State
+ * @param doublePrep Spatial modes with two-photon preparation
+ * @param SFullDist Output of the circuit, afterwards the part that is orthogonal to all acceptable measurement results
+ * @param SVec Output: States for the measurement outcomes, overlapping with GHZ in spatial and polarization
+ * @param compVec Output: States for the measurement outcomes, orthogonal to GHZ
+ * @param SKeyIter Output: State whose keys are all input combinations of DModes
+ */
+template<class K, class V, class R>
+void fidSplit(const std::vector<int>& doublePrep, State<K, V, R>& SFullDist, std::array<State<K, V, R>, 8>& SVec, std::array<State<K, V, R>, 8>& compVec, State<K, V, R>& SKeyIter){
+    State<K, V, R> STemp, SComplement;
+    std::vector<boost::container::flat_map<int, int>> 
+    g = {{{0, 1}, {1, 0}, {6, 1}, {7, 0}, {10, 1}, {11, 0}}, {{0, 0}, {1, 1}, {6, 0}, {7, 1}, {10, 0}, {11, 1}}};
+    std::vector<std::vector<int>> occModes={{0, 6, 10}, {1, 7, 11}};
+    std::vector<boost::container::flat_map<int,int>> FirstMeasTargets;
+    for (int p1: {0, 1})
+        for (int p2: {0, 1})
+            for (int p4: {0, 1}){
+                STemp = SFullDist;
+                SComplement = STemp.overlapWithFilter({{2, 1-p1}, {3, p1}, {4, 1-p2}, {5, p2}, {8, 1-p4}, {9, p4}}, occModes, g);
+                FirstMeasTargets.push_back({{2, 1-p1}, {3, p1}, {4, 1-p2}, {5, p2}, {8, 1-p4}, {9, p4}});
+                SVec[p4+2*p2+4*p1] = std::move(STemp);
+                compVec[p4+2*p2+4*p1] = std::move(SComplement);
+                }
+    SFullDist.overlapCompl(FirstMeasTargets, occModes);
+    SKeyIter.set(12);
+    SKeyIter.set(&trivOvl<V, R>);
+    for (int i=0; i<6; i++){
+        if (std::find(doublePrep.begin(), doublePrep.end(), i)!=doublePrep.end())
+            SKeyIter.addPhoton({(R) i, 0.7}, 2*i, 2);
+        else
+            SKeyIter.addPhoton({(R) i, 0.7}, 2*i, 1);
+    }
+}
+
+/**
+ * @brief Runs the circuit on the perfectly distinguishable input and splits the outcome according to the first measurement.
+ * 
+ * @tparam K Key-type, cf. State
+ * @tparam V Value-type, cf. State
+ * @tparam R Real-type, cf. State
+ * @param doublePrep Spatial modes with two-photon preparation
+ * @param lossPos Positions where loss happens
+ * @param apl Rotations as unitaries repr. as single line unitaries (already including the rotation errors)
+ * @param SFullDist Output: Part of the state that is orthogonal to all acceptable measurement results
+ * @param SVec Output: States for the measurement outcomes, overlapping with GHZ in spatial and polarization
+ * @param compVec Output: States for the measurement outcomes, orthogonal to GHZ
+ * @param SKeyIter Output: State whose keys are all input combinations of DModes
+ * @param budget If positive, the circuit truncates adaptively such that the discarded squared norm stays below budget (cf. State::setBudget()), otherwise the fixed tolerance is used.
+ * The truncations of the circuit are recorded in SFullDist, cf. State::truncBound()
+ */
+template<class K, class V, class R>
+void fidPrepare(const std::vector<int>& doublePrep, const std::vector<int>& lossPos, const std::array<std::vector<V>, 15>& apl, State<K, V, R>& SFullDist, std::array<State<K, V, R>, 8>& SVec, std::array<State<K, V, R>, 8>& compVec, State<K, V, R>& SKeyIter, accum_t<R> budget = 0){
+    fidInit(doublePrep, SFullDist);
+    SFullDist.setBudget(budget);
+    circuitFid(SFullDist, lossPos, apl);
+    SFullDist.setBudget(0); //the parts are truncated with the fixed tolerance from here on, otherwise each of them could spend the remaining budget
+    fidSplit(doublePrep, SFullDist, SVec, compVec, SKeyIter);
+}
+
+/**
+ * @brief Runs all input combinations of DModes on the split output of the circuit (cf. fidSplit()) and folds them into the accumulators of fidsim().
+ * The states of the loop over the configurations are stored in H, e.g. Half or BF16 (cf. Half.hpp) to halve the amplitude storage.
+ * 
+ * @tparam K Key-type, cf. State
+ * @tparam H Value-type used to store the states in the loop over the configurations
+ * @tparam V Value-type, cf. State
+ * @tparam R Real-type, cf. State
+ * @param ovls Overlaps, one lane per overlap
+ * @param SFullDist Part of the state that is orthogonal to all acceptable measurement results
+ * @param SVec States for the measurement outcomes, overlapping with GHZ in spatial and polarization
+ * @param compVec States for the measurement outcomes, orthogonal to GHZ
+ * @param SKeyIter State whose keys are all input combinations of DModes
+ * @param StV Output: accumulator for the overlap with the GHZ state
+ * @param StV2 Output: accumulator for the accepted states
+ * @return R Truncation bound, i.e. the bound on the norm discarded in the circuit (cf. State::truncBound()) plus the largest norm discarded for a configuration.
+ * This bounds the unnormalized accumulated amplitudes, not the error of the normalized fidelity
+ */
+template<class K, class H, class V, class R>
+R fidAccumulate(const std::vector<R>& ovls, const State<K, V, R>& SFullDist, const std::array<State<K, V, R>, 8>& SVec, const std::array<State<K, V, R>, 8>& compVec, const State<K, V, R>& SKeyIter, LaneAcc<K, H, R>& StV, LaneAcc<K, H, R>& StV2){
+    BlockState<K, H, R> SBlock;
+    State<K, H, R> SAgg, compAgg;
+    accum_t<R> loopBound = 0;
+    SBlock.set(convertState<H>(SFullDist));
+    SAgg = convertState<H>(foldOutcomes(SVec)); //the outcomes only differ by the phase of the GHZ state, one collapse and projection serves all of them
+    compAgg = convertState<H>(foldOutcomes(compVec));
+    size_t n = SKeyIter.size();
+    std::vector<std::vector<V>> refs = fidRefs<K, V, R>(ovls, n);
+    std::vector<LaneAcc<K, H, R>> acc(FID_CHUNKS, LaneAcc<K, H, R>(ovls.size())), acc2(FID_CHUNKS, LaneAcc<K, H, R>(ovls.size()));
+    std::vector<accum_t<R>> bounds(FID_CHUNKS, 0.0);
+    KERNEL_PARALLEL_FOR(FID_CHUNKS)
+    for (size_t k = 0; k<FID_CHUNKS; k++){ //fixed chunks of consecutive configurations, folded in order
+        BlockState<K, H, R> STemp;
+        State<K, H, R> SAggTemp, compAggTemp;
+        for (size_t i = k*n/FID_CHUNKS; i<(k+1)*n/FID_CHUNKS; i++){ //every configuration is folded into the accumulators of all overlaps and discarded
+            STemp = SBlock;
+            SAggTemp = SAgg;
+            compAggTemp = compAgg;
+            collapseRenorm((SKeyIter.cbegin()+i)->first, SAggTemp, compAggTemp, STemp);
+            fidAdd(SAggTemp, compAggTemp, refs[i], acc[k], acc2[k]);
+            bounds[k] = std::max(bounds[k], SAggTemp.truncBound()+compAggTemp.truncBound());
+        }
+    }
+    pairwiseReduce(acc, [](LaneAcc<K, H, R>& a, LaneAcc<K, H, R>& b){a.add(b); b = LaneAcc<K, H, R>();});
+    pairwiseReduce(acc2, [](LaneAcc<K, H, R>& a, LaneAcc<K, H, R>& b){a.add(b); b = LaneAcc<K, H, R>();});
+    StV = std::move(acc[0]);
+    StV2 = std::move(acc2[0]);
+    for (accum_t<R> b : bounds)
+        loopBound = std::max(loopBound, b);
+    return SFullDist.truncBound()+loopBound;
+}
+
+/**
+ * @brief Runs all input combinations of DModes and folds them into the accumulators of fidsim().
+ * The circuit is computed in V, the states of the loop over the configurations are stored in H, e.g. Half or BF16 (cf. Half.hpp) to halve the amplitude storage.
+ * 
+ * @tparam K Key-type, cf. State
+ * @tparam H Value-type used to store the states in the loop over the configurations
+ * @tparam V Value-type, cf. State
+ * @tparam R Real-type, cf. State
+ * @param ovls Overlaps, one lane per overlap
+ * @param doublePrep Spatial modes with two-photon preparation
+ * @param lossPos Positions where loss happens
+ * @param apl Rotations as unitaries repr. as single line unitaries (already including the rotation errors)
+ * @param StV Output: accumulator for the overlap with the GHZ state
+ * @param StV2 Output: accumulator for the accepted states
+ * @param budget Budget for the discarded squared norm in the circuit, cf. fidPrepare()
+ * @return R Truncation bound, i.e. the bound on the norm discarded in the circuit (cf. State::truncBound()) plus the largest norm discarded for a configuration,
+ * a bound on the unnormalized amplitudes only. Scenarios without accepted events (cf. fidFeasible()) are not simulated, the accumulators stay empty.
+ */
+template<class K, class H, class V, class R>
+R fidAccumulate(const std::vector<R>& ovls, const std::vector<int>& doublePrep, const std::vector<int>& lossPos, const std::array<std::vector<V>, 15>& apl, LaneAcc<K, H, R>& StV, LaneAcc<K, H, R>& StV2, accum_t<R> budget = 0){
+    State<K, V, R> SFullDist, SKeyIter;
+    std::array<State<K, V, R>, 8> SVec, compVec;
+    if (!fidFeasible(doublePrep, lossPos)){ //no accepted event, the empty accumulators give probability 0
+        StV = LaneAcc<K, H, R>(ovls.size());
+        StV2 = LaneAcc<K, H, R>(ovls.size());
+        return 0;
+    }
+    fidPrepare(doublePrep, lossPos, apl, SFullDist, SVec, compVec, SKeyIter, budget);
+    return fidAccumulate(ovls, SFullDist, SVec, compVec, SKeyIter, StV, StV2);
+}
 
 /**
- * @brief Cleans input such that only the keys with the same DMode in one of the parts of the GHZ state remain.
+ * @brief Computes the fidelity for a given parameters. With V = Dual<R, 15> and apl from genRotationsBasic<V, R>(), every result is followed by its
+ * derivatives w.r.t. the 15 angle errors (in degree) in the same run, cf. Dual.hpp and fidResults().
  * 
  * @tparam K Key-type, cf. State
  * @tparam V Value-type, cf. State
  * @tparam R Real-type, cf. State
- * @param S State to compute to overlap for
- * @param a phase for GHZ state - either 1 or -1
+ * @tparam H Value-type used to store the states in the loop over the configurations, defaults to V, cf. fidAccumulate()
+ * @param ovls Overlaps, for all of them the fidelity is computed
+ * @param doublePrep Spatial modes with two-photon preparation
+ * @param lossPos Positions where loss happens
+ * @param angErrs Rotation-errors for wave-plates
+ * @param apl Rotations as unitaries repr. as single line unitaries (already including the rotation errors)
+ * @param path Pathsuffix where to save the outcome
+ * @param rank Rank of the process (used for saving the outcome)
+ * @param perOutcome If set, the probability and fidelity of every outcome are written, otherwise only the aggregate over all outcomes, cf. fidWrite()
+ * @param budget If positive, the circuit truncates adaptively with this budget for the discarded squared norm (cf. fidPrepare()) and the truncation bound (cf. fidAccumulate()) is written as last entry.
+ * The bound is on the unnormalized discarded norm, the shift of the written fidelities is usually far smaller and not bounded by it
  */
-template<class K, class V, class R>
-inline void cleanOvlGHZ(State<K, V, R>& S, int a){
-    V f = 1.0/std::sqrt(2), f2 = ((V) a)/std::sqrt(2);
-    S.sameDModeDel({{0, 6, 10}, {1, 7, 11}}, {f, f2}); //Projection where all 
+template<class K = Key<int>, class V, class R, class H = V>
+void fidsim(const std::vector<R>& ovls, const std::vector<int>& doublePrep, const std::vector<int>& lossPos, const std::vector<R>& angErrs, const std::array<std::vector<V>, 15>& apl, const std::string& path, int rank, bool perOutcome = true, R budget = 0){
+    LaneAcc<K, H, R> StV, StV2;
+    R bound = fidAccumulate(ovls, doublePrep, lossPos, apl, StV, StV2, budget);
+    if (!(budget > 0)){
+        fidWrite(StV, StV2, ovls, angErrs, doublePrep, lossPos, path, rank, perOutcome);
+        return;
+    }
+    std::vector<std::vector<R>> res = fidResults(StV, StV2, perOutcome);
+    for (size_t o=0; o<ovls.size(); o++){
+        res[o].push_back(bound);
+        write(lossPos, doublePrep, angErrs, ovls[o], path, rank, res[o]);
+    }
 }
 
 /**
- * @brief Computes the fidelity for pre-computed data and writes it to a file.
+ * @brief Computes the fidelity for a batch of samples of the rotation errors in one pass, with V = Batch<R, N> and apl from genRotationsBasic() for samples,
+ * cf. Batch.hpp. Every sample is written as a separate line with its rotation errors, in the format of fidsim().
  * 
- * @param PreData Vector of Arrays (one for every input combination of DModes) of the remaining states after the measurement already projected onto the spatial and polarization modes of the GHZ state
- * @param Compl Same data structure as PreData. These contains the complement of the states after the measurement, i.e. those parts orthogonal to the GHZ state.
- * @param ovl Pairwise overlap
- * @param angErrs Angle errors in the setup
- * @param doublePrep Events/positions of double-preparation
- * @param lossPos Events/positions of loss
- * @param path The path to the folder where the data should be saves.
- * @param rank The rank of the current process. Used for saving the data to the file.
+ * @tparam K Key-type, cf. State
+ * @tparam V Value-type, a Batch, cf. State
+ * @tparam R Real-type, cf. State
+ * @param ovls Overlaps, for all of them the fidelity is computed
+ * @param doublePrep Spatial modes with two-photon preparation
+ * @param lossPos Positions where loss happens
+ * @param angErrs Samples of the rotation-errors for wave-plates, at most V::width
+ * @param apl Rotations as unitaries repr. as single line unitaries, one sample per lane
+ * @param path Pathsuffix where to save the outcome
+ * @param rank Rank of the process (used for saving the outcome)
+ * @param perOutcome If set, the probability and fidelity of every outcome are written, otherwise only the aggregate over all outcomes, cf. fidWrite()
  */
-inline void fid(const std::vector<std::array<State<Key<int>, float, float>, 8>>& PreData, const std::vector<std::array<State<Key<int>, float, float>, 8>>& Compl, const float& ovl, const std::vector<float>& angErrs, const std::vector<int>& doublePrep, const std::vector<int>& lossPos, const std::string& path, int rank){
-    State<Key<int>, float, float> S, S2, S3;
-    S.set(&trivOvlF);
-    S.set((float) std::pow(10, -8));
-    std::array<State<Key<int>, float, float>, 8> StV, StV2;
-    for (int i=0; i<8; i++) {StV[i] = S; StV2[i] = S;};
-    for (int i=0; i<6; i++){
-            S.addPhoton({(float) i, ovl}, 2*i, 1);
-    }
-    int i=0;
-    boost::container::flat_map<int, int> M({{0, 1}, {1, -1}, {2, -1}, {3, 1}, {4, -1}, {5, 1}, {6, 1}, {7, -1}});
-    for (typename State<Key<int>, float, float>::iterator it = S.begin(); it!=S.end();it++){
-        for (int j = 0; j<8; j++){
-            S2 = PreData[i][j];
-            cleanOvlGHZ(S2, M[j]);
-            StV[j].add(S2, it->second);
-            StV2[j].add(PreData[i][j], it->second);
-            StV2[j].add(Compl[i][j], it->second);}
-        i++;
-    }
-    std::vector<float> res;
-    for (int i=0; i<8; i++) {
-        res.push_back(std::pow(StV2[i].norm(), 2));
-        res.push_back(std::pow(StV[i].norm(), 2)/std::pow(StV2[i].norm(), 2));}
-    write(lossPos, doublePrep, angErrs, ovl, path, rank, res);
+template<class K = Key<int>, class V, class R>
+void fidsim(const std::vector<R>& ovls, const std::vector<int>& doublePrep, const std::vector<int>& lossPos, const std::vector<std::vector<R>>& angErrs, const std::array<std::vector<V>, 15>& apl, const std::string& path, int rank, bool perOutcome = true){
+    LaneAcc<K, V, R> StV, StV2;
+    fidAccumulate(ovls, doublePrep, lossPos, apl, StV, StV2);
+    std::vector<std::vector<sqnorm_t<V>>> e = fidEntries(StV, StV2, perOutcome);
+    std::vector<R> res;
+    for (size_t o=0; o<ovls.size(); o++)
+        for (size_t l=0; l<angErrs.size() && l<V::width; l++){
+            res.clear();
+            for (const sqnorm_t<V>& x : e[o])
+                res.push_back((R) x[l]);
+            write(lossPos, doublePrep, angErrs[l], ovls[o], path, rank, res);
+        }
 }
 
 /**
- * @brief The photonic circuit we considered to create a GHZ state.
+ * @brief Same as fidsim() with the states stored in H, and compares the results to the ones with the states stored in V.
+ * The results for H are written to path, the absolute deviations of every entry from the results for V are written to path+"cmp" in the same format.
  * 
+ * @tparam H Value-type used to store the states in the loop over the configurations, e.g. Half or BF16
  * @tparam K Key-type, cf. State
  * @tparam V Value-type, cf. State
  * @tparam R Real-type, cf. State
- * @param S State to perform the circuit on.
+ * @param ovls Overlaps, for all of them the fidelity is computed
+ * @param doublePrep Spatial modes with two-photon preparation
  * @param lossPos Positions where loss happens
- * @param apl Rotations as unitaries repr. as single line unitaries 
+ * @param angErrs Rotation-errors for wave-plates
+ * @param apl Rotations as unitaries repr. as single line unitaries (already including the rotation errors)
+ * @param path Pathsuffix where to save the outcome
+ * @param rank Rank of the process (used for saving the outcome)
+ * @param perOutcome If set, the probability and fidelity of every outcome are written, otherwise only the aggregate over all outcomes, cf. fidWrite()
+ * @return R Largest absolute deviation of a fidelity
  */
-template<class K, class V, class R>
-inline void circuitFid(State<K, V, R>& S, const std::vector<int>& lossPos, const std::array<std::vector<V>, 15>& apl){
-    State<K, V, R> S2;
-    for (int i=0; i<6; i++) detloss(S, i, {2*i}, lossPos);
-    for (int i=0; i<6; i++) detloss(S, i+6, {2*i}, lossPos);
-    for (int i=0; i<6; i++)
-        S.apply(apl[i], {2*i, 2*i+1});
-    for (int i=0; i<6; i++) detloss(S, i+12, {2*i, 2*i+1}, lossPos);
-    for (int i=0; i<3; i++)
-        S.swap(4*i+1, 4*i+3);
-    for (int i=0; i<6; i++) detloss(S, i+18, {2*i, 2*i+1}, lossPos);
-    for (int i=0; i<6;i++)
-        S.apply(apl[i+6], {2*i, 2*i+1});
-    detloss(S, 24, {2, 3}, lossPos);
-    detloss(S, 25, {4, 5}, lossPos);
-    S.swap(3, 5);
-    detloss(S, 26, {4, 5}, lossPos);
-    detloss(S, 27, {8, 9}, lossPos);
-    S.swap(5, 9);
-    detloss(S, 28, {2, 3}, lossPos);
-    detloss(S, 29, {4, 5}, lossPos);
-    detloss(S, 30, {8, 9}, lossPos);
-    S.apply(apl[12], {2, 3});
-    S.apply(apl[13], {4, 5});
-    S.apply(apl[14], {8, 9});
-    detloss(S, 32, {2, 3}, lossPos);
-    detloss(S, 33, {4, 5}, lossPos);
-    detloss(S, 35, {8, 9}, lossPos);
+template<class H, class K = Key<int>, class V, class R>
+R fidsimCompare(const std::vector<R>& ovls, const std::vector<int>& doublePrep, const std::vector<int>& lossPos, const std::vector<R>& angErrs, const std::array<std::vector<V>, 15>& apl, const std::string& path, int rank, bool perOutcome = true){
+    LaneAcc<K, H, R> StV, StV2;
+    LaneAcc<K, V, R> RefV, RefV2;
+    fidAccumulate(ovls, doublePrep, lossPos, apl, StV, StV2);
+    fidAccumulate(ovls, doublePrep, lossPos, apl, RefV, RefV2);
+    std::vector<std::vector<R>> res = fidResults(StV, StV2, perOutcome), ref = fidResults(RefV, RefV2, perOutcome);
+    std::vector<R> dev;
+    R maxDev = 0;
+    for (size_t o=0; o<ovls.size(); o++){
+        dev.clear();
+        for (size_t i=0; i<res[o].size(); i++){
+            dev.push_back(std::abs(res[o][i]-ref[o][i]));
+            if (i%2 == 1 && dev.back() > maxDev) //odd entries are fidelities
+                maxDev = dev.back();
+        }
+        write(lossPos, doublePrep, angErrs, ovls[o], path, rank, res[o]);
+        write(lossPos, doublePrep, angErrs, ovls[o], path+"cmp", rank, dev);
+    }
+    return maxDev;
 }
 
 /**
- * @brief Maps a the perfectly distinguishable configuration to a partially distinguishability conf.
+ * @brief Checks the derivatives of fidsim() with V = Dual<R, 15> w.r.t. rotation error l against central finite differences with step h.
+ * The derivatives are written to path, the absolute deviations from the finite differences to path+"cmp", both in the format of fidsim().
  * 
- * @param K Key that encodes the desired distinguishability configuration
- * @param SVec States that should be used for the result, completly overlapping with GHZ in spatial and polarization and acceptable measurement results.
- * @param comp States that are used for normalization, i.e. part of the measurement result but orthogonal to GHZ, as map is not norm preserving
- * @param S Part of the state that is orthogonal to all acceptable measurement results
+ * @tparam K Key-type, cf. State
+ * @tparam R Real-type, cf. State
+ * @param ovls Overlaps, for all of them the fidelity is computed
+ * @param doublePrep Spatial modes with two-photon preparation
+ * @param lossPos Positions where loss happens
+ * @param angErrs Rotation-errors for wave-plates
+ * @param l Index of the checked rotation error
+ * @param h Step of the finite differences (in degree)
+ * @param path Pathsuffix where to save the outcome
+ * @param rank Rank of the process (used for saving the outcome)
+ * @param perOutcome If set, the probability and fidelity of every outcome are checked, otherwise only the aggregate over all outcomes, cf. fidWrite()
+ * @return R Largest absolute deviation of a derivative
  */
-void collapseRenorm(const Key<int>& K, std::array<State<Key<int>, float, float>, 8>& SVec, std::array<State<Key<int>, float, float>, 8>& comp, State<Key<int>, float, float>& S){
-    float n=0.0;
-    for (int i = 0; i<8; i++){
-        SVec[i].collapse(K);
-        comp[i].collapse(K);
-        n += std::pow(SVec[i].norm(),2);
-        n += std::pow(comp[i].norm(),2);
+template<class K = Key<int>, class R>
+R fidsimCheckDeriv(const std::vector<R>& ovls, const std::vector<int>& doublePrep, const std::vector<int>& lossPos, const std::vector<R>& angErrs, int l, R h, const std::string& path, int rank, bool perOutcome = true){
+    LaneAcc<K, Dual<R, 15>, R> StV, StV2;
+    fidAccumulate(ovls, doublePrep, lossPos, genRotationsBasic<Dual<R, 15>, R>(angErrs), StV, StV2);
+    std::vector<std::vector<R>> ad = fidResults(StV, StV2, perOutcome), fd[2];
+    for (int s=0; s<2; s++){
+        std::vector<R> errs = angErrs;
+        errs[l] += s ? -h : h;
+        LaneAcc<K, R, R> FdV, FdV2;
+        fidAccumulate(ovls, doublePrep, lossPos, genRotationsBasic<R, R>(errs), FdV, FdV2);
+        fd[s] = fidResults(FdV, FdV2, perOutcome);
     }
-    S.collapse(K);
-    n += std::pow(S.norm(),2);
-    if (n!=0.0){
-    n = 1/std::sqrt(n);
-    for (int i = 0; i<8; i++){
-        SVec[i].mul(n);
-        comp[i].mul(n);
-    }}
+    std::vector<R> der, dev;
+    R maxDev = 0;
+    for (size_t o=0; o<ovls.size(); o++){
+        der.clear();
+        dev.clear();
+        for (size_t i=0; i<fd[0][o].size(); i++){ //after the values, the derivatives follow in blocks of 15 per value, cf. toReals()
+            der.push_back(ad[o][fd[0][o].size()+15*i+l]);
+            dev.push_back(std::abs(der.back()-(fd[0][o][i]-fd[1][o][i])/(2*h)));
+            maxDev = std::max(maxDev, dev.back());
+        }
+        write(lossPos, doublePrep, angErrs, ovls[o], path, rank, der);
+        write(lossPos, doublePrep, angErrs, ovls[o], path+"cmp", rank, dev);
+    }
+    return maxDev;
+}
+
+/**
+ * @brief Computes the overlap-independent representation of the fidelity (cf. FidPoly) for given parameters.
+ * 
+ * @tparam K Key-type, cf. State
+ * @tparam R Real-type, cf. State. The amplitudes are R as well, cf. FidPoly
+ * @param doublePrep Spatial modes with two-photon preparation
+ * @param lossPos Positions where loss happens
+ * @param apl Rotations as unitaries repr. as single line unitaries (already including the rotation errors)
+ * @param perConf If set, the representation can be evaluated for general overlap matrices, cf. FidPoly
+ * @return FidPoly<R, K> The representation
+ */
+template<class K = Key<int>, class R>
+FidPoly<R, K> fidpoly(const std::vector<int>& doublePrep, const std::vector<int>& lossPos, const std::array<std::vector<R>, 15>& apl, bool perConf = false){
+    State<K, R, R> SFullDist, SKeyIter;
+    BlockState<K, R, R> SBlock, STemp;
+    std::array<State<K, R, R>, 8> SVec, compVec, SVecTemp, compVecTemp;
+    fidPrepare(doublePrep, lossPos, apl, SFullDist, SVec, compVec, SKeyIter);
+    SBlock.set(SFullDist);
+    FidPoly<R, K> FP(perConf);
+    for (typename State<K, R, R>::iterator it = SKeyIter.begin(); it!=SKeyIter.end();it++){
+        STemp = SBlock;
+        SVecTemp = SVec;
+        compVecTemp = compVec;
+        collapseRenorm(it->first, SVecTemp, compVecTemp, STemp);
+        FP.add(it->first, fidProject(SVecTemp), SVecTemp, compVecTemp);
+    }
+    return FP;
+}
+
+/**
+ * @brief Saves the representation of the fidelity of one scenario to path+"poly"+rank.
+ * 
+ * @tparam K Key-type, cf. State
+ * @tparam R Real-type, cf. State. The amplitudes are R as well, cf. FidPoly
+ * @param FP The representation
+ * @param doublePrep Spatial modes with two-photon preparation
+ * @param lossPos Positions where loss happens
+ * @param path Pathsuffix where to save the representation
+ * @param rank Rank of the process (used for saving the representation)
+ */
+template<class K, class R>
+void savePoly(const FidPoly<R, K>& FP, const std::vector<int>& doublePrep, const std::vector<int>& lossPos, const std::string& path, int rank){
+    std::ofstream myfile;
+    myfile.open(path+"poly"+std::to_string(rank)+".txt", std::ios_base::app);
+    for (int i: doublePrep) myfile << i << "|";
+    myfile << " ";
+    for (int i: lossPos) myfile << i << "|";
+    myfile << "\n";
+    FP.save(myfile);
+    myfile.close();
 }
 
 /**
- * @brief Computes the fidelity for a given parameters.
+ * @brief Computes the overlap-independent representation of the fidelity (cf. FidPoly) for given parameters, saves it and writes the fidelity for all overlaps in ovls.
  * 
+ * @tparam K Key-type, cf. State
+ * @tparam R Real-type, cf. State. The amplitudes are R as well, cf. FidPoly
  * @param ovls Overlaps, for all of them the fidelity is computed
  * @param doublePrep Spatial modes with two-photon preparation
  * @param lossPos Positions where loss happens
  * @param angErrs Rotation-errors for wave-plates
  * @param apl Rotations as unitaries repr. as single line unitaries (already including the rotation errors)
- * @param path Pathsuffix where to save the outcome
+ * @param path Pathsuffix where to save the outcome, the representation is saved to path+"poly"+rank
  * @param rank Rank of the process (used for saving the outcome)
+ * @return FidPoly<R, K> The representation, which can be evaluated for further overlaps
  */
-void fidsim(const std::vector<float>& ovls, const std::vector<int>& doublePrep, const std::vector<int>& lossPos, const std::vector<float>& angErrs, const std::array<std::vector<float>, 15>& apl, const std::string& path, int rank){
-    State<Key<int>, float, float> SFullDist, SKeyIter, STemp, SComplement;
+template<class K = Key<int>, class R>
+FidPoly<R, K> fidsimPoly(const std::vector<R>& ovls, const std::vector<int>& doublePrep, const std::vector<int>& lossPos, const std::vector<R>& angErrs, const std::array<std::vector<R>, 15>& apl, const std::string& path, int rank){
+    FidPoly<R, K> FP = fidpoly<K>(doublePrep, lossPos, apl);
+    savePoly(FP, doublePrep, lossPos, path, rank);
+    for (R o : ovls)
+        write(lossPos, doublePrep, angErrs, o, path, rank, FP.eval(o));
+    return FP;
+}
 
-    SFullDist.set(12);
-    SFullDist.set(&trivOvlF);
-    for (int i=0; i<6; i++){
-        if (std::find(doublePrep.begin(), doublePrep.end(), i)!=doublePrep.end())
-            SFullDist.addPhoton({(float) i, 0.0}, 2*i, 2);
-        else
-            SFullDist.addPhoton({(float) i, 0.0}, 2*i, 1);
+/**
+ * @brief Computes the fidelity for a batch of overlap matrices. The circuit and the collapse are done once, all matrices are evaluated on the cached representation.
+ * 
+ * @tparam K Key-type, cf. State
+ * @tparam R Real-type, cf. State. The amplitudes are R as well, cf. FidPoly
+ * @param Gs 6x6 matrices of pairwise overlaps of the sources, for all of them the fidelity is computed
+ * @param doublePrep Spatial modes with two-photon preparation
+ * @param lossPos Positions where loss happens
+ * @param angErrs Rotation-errors for wave-plates
+ * @param apl Rotations as unitaries repr. as single line unitaries (already including the rotation errors)
+ * @param path Pathsuffix where to save the outcome, the representation is saved to path+"poly"+rank
+ * @param rank Rank of the process (used for saving the outcome)
+ * @return FidPoly<R, K> The representation, which can be evaluated for further matrices
+ */
+template<class K = Key<int>, class R>
+FidPoly<R, K> fidsimMat(const std::vector<std::vector<std::vector<R>>>& Gs, const std::vector<int>& doublePrep, const std::vector<int>& lossPos, const std::vector<R>& angErrs, const std::array<std::vector<R>, 15>& apl, const std::string& path, int rank){
+    FidPoly<R, K> FP = fidpoly<K>(doublePrep, lossPos, apl, true);
+    savePoly(FP, doublePrep, lossPos, path, rank);
+    std::vector<std::vector<R>> res = FP.eval(Gs);
+    for (size_t l=0; l<Gs.size(); l++)
+        write(lossPos, doublePrep, angErrs, Gs[l], path, rank, res[l]);
+    return FP;
+}
+
+/**
+ * @brief Computes the Chebyshev surrogate of the fidelity over the rotation errors (cf. FidCheb) for given parameters. The circuit is run for
+ * samples of the errors in batches of N (cf. Batch.hpp), the number of samples is rounded up to a multiple of N.
+ * 
+ * @tparam K Key-type, cf. State
+ * @tparam R Real-type, cf. State
+ * @tparam N Number of samples per run of the circuit
+ * @param ovls Overlaps, for all of them the surrogate is computed
+ * @param doublePrep Spatial modes with two-photon preparation
+ * @param lossPos Positions where loss happens
+ * @param deg Maximal total degree of the surrogate
+ * @param width Half width of the box of the errors, in degree
+ * @param samples Number of samples, if 0 twice the number of terms
+ * @param seed Seed of the samples, cf. FidCheb::samples()
+ * @param perOutcome If set, the probability and fidelity of every outcome are fitted, otherwise only the aggregate over all outcomes, cf. fidWrite()
+ * @return FidCheb<R> The surrogate
+ */
+template<class K = Key<int>, class R, int N = 16>
+FidCheb<R> fidcheb(const std::vector<R>& ovls, const std::vector<int>& doublePrep, const std::vector<int>& lossPos, int deg, R width, size_t samples = 0, unsigned seed = 1, bool perOutcome = true){
+    FidCheb<R> FC(deg, width);
+    std::mt19937 gen(seed);
+    if (samples == 0) samples = 2*FC.size();
+    std::vector<std::vector<R>> errs = FC.samples((samples+N-1)/N*N, gen), batch;
+    std::vector<std::vector<std::vector<R>>> res(errs.size(), std::vector<std::vector<R>>(ovls.size()));
+    for (size_t s = 0; s<errs.size(); s+=N){
+        batch.assign(errs.begin()+s, errs.begin()+s+N);
+        LaneAcc<K, Batch<R, N>, R> StV, StV2;
+        fidAccumulate(ovls, doublePrep, lossPos, genRotationsBasic<Batch<R, N>, R>(batch), StV, StV2);
+        std::vector<std::vector<sqnorm_t<Batch<R, N>>>> e = fidEntries(StV, StV2, perOutcome);
+        for (int l = 0; l<N; l++)
+            for (size_t o = 0; o<ovls.size(); o++)
+                for (const sqnorm_t<Batch<R, N>>& x : e[o])
+                    res[s+l][o].push_back((R) x[l]);
     }
-    circuitFid(SFullDist, lossPos, apl);
+    FC.fit(ovls, errs, res);
+    return FC;
+}
 
-    std::array<std::pair<State<Key<int>, float, float>, State<Key<int>, float, float>>, 8> SV;
-    std::vector<std::array<State<Key<int>, float, float>, 8>> SarS, SarComp;
-    std::vector<boost::container::flat_map<int, int>> 
-    g = {{{0, 1}, {1, 0}, {6, 1}, {7, 0}, {10, 1}, {11, 0}}, {{0, 0}, {1, 1}, {6, 0}, {7, 1}, {10, 0}, {11, 1}}};
-    std::vector<std::vector<int>> occModes={{0, 6, 10}, {1, 7, 11}};
-    std::array<State<Key<int>, float, float>, 8> SVec, compVec, SVecTemp, compVecTemp;
-    std::vector<boost::container::flat_map<int,int>> FirstMeasTargets;
-    for (int p1: {0, 1})
-        for (int p2: {0, 1})
-            for (int p4: {0, 1}){
-                STemp = SFullDist;
-                SComplement = STemp.overlapWithFilter({{2, 1-p1}, {3, p1}, {4, 1-p2}, {5, p2}, {8, 1-p4}, {9, p4}}, occModes, g);
-                FirstMeasTargets.push_back({{2, 1-p1}, {3, p1}, {4, 1-p2}, {5, p2}, {8, 1-p4}, {9, p4}});
-                SVec[p4+2*p2+4*p1] = std::move(STemp);
-                compVec[p4+2*p2+4*p1] = std::move(SComplement);
-                }
-    SFullDist.overlapCompl(FirstMeasTargets, occModes);
-    SKeyIter.set(12);
-    SKeyIter.set(&trivOvlF);
-    for (int i=0; i<6; i++){
-        if (std::find(doublePrep.begin(), doublePrep.end(), i)!=doublePrep.end())
-            SKeyIter.addPhoton({(float) i, 0.7}, 2*i, 2);
-        else
-            SKeyIter.addPhoton({(float) i, 0.7}, 2*i, 1);
+/**
+ * @brief Saves the surrogate of the fidelity of one scenario to path+"cheb"+rank.
+ * 
+ * @tparam R Real-type, cf. State
+ * @param FC The surrogate
+ * @param doublePrep Spatial modes with two-photon preparation
+ * @param lossPos Positions where loss happens
+ * @param path Pathsuffix where to save the surrogate
+ * @param rank Rank of the process (used for saving the surrogate)
+ */
+template<class R>
+void saveCheb(const FidCheb<R>& FC, const std::vector<int>& doublePrep, const std::vector<int>& lossPos, const std::string& path, int rank){
+    std::ofstream myfile;
+    myfile.open(path+"cheb"+std::to_string(rank)+".txt", std::ios_base::app);
+    for (int i: doublePrep) myfile << i << "|";
+    myfile << " ";
+    for (int i: lossPos) myfile << i << "|";
+    myfile << "\n";
+    FC.save(myfile);
+    myfile.close();
+}
+
+/**
+ * @brief Computes the surrogate of the fidelity over the rotation errors (cf. fidcheb()), saves it and writes the fidelity for all query points.
+ * 
+ * @tparam K Key-type, cf. State
+ * @tparam R Real-type, cf. State
+ * @param ovls Overlaps, for all of them the fidelity is computed
+ * @param doublePrep Spatial modes with two-photon preparation
+ * @param lossPos Positions where loss happens
+ * @param queries Rotation-errors for wave-plates, for all of them the fidelity is evaluated with the surrogate
+ * @param deg Maximal total degree of the surrogate
+ * @param width Half width of the box of the errors, in degree
+ * @param path Pathsuffix where to save the outcome, the surrogate is saved to path+"cheb"+rank
+ * @param rank Rank of the process (used for saving the outcome)
+ * @return FidCheb<R> The surrogate, which can be evaluated for further errors
+ */
+template<class K = Key<int>, class R>
+FidCheb<R> fidsimCheb(const std::vector<R>& ovls, const std::vector<int>& doublePrep, const std::vector<int>& lossPos, const std::vector<std::vector<R>>& queries, int deg, R width, const std::string& path, int rank){
+    FidCheb<R> FC = fidcheb<K>(ovls, doublePrep, lossPos, deg, width);
+    saveCheb(FC, doublePrep, lossPos, path, rank);
+    std::vector<std::vector<std::vector<R>>> res = FC.eval(queries);
+    for (size_t q=0; q<queries.size(); q++)
+        for (size_t o=0; o<ovls.size(); o++)
+            write(lossPos, doublePrep, queries[q], ovls[o], path, rank, res[q][o]);
+    return FC;
+}
+
+/**
+ * @brief Walks the trie of the loss steps of scenarios with the same doublePrep depth-first, cf. fidsimTrie(). All scenarios in [b, e) have the same
+ * first depth loss steps, which are done in S, and S is the state before step. The circuit up to the next branching step is run once for all of them.
+ * 
+ * @tparam K Key-type, cf. State
+ * @tparam V Value-type, cf. State
+ * @tparam R Real-type, cf. State
+ * @tparam F Callable (size_t, const State<K, V, R>&)
+ * @param S State before step, it is advanced by the walk
+ * @param step Next step of the circuit, cf. circuitSteps()
+ * @param steps For every scenario the sorted steps of its losses, cf. lossStep()
+ * @param b Begin of the scenarios, sorted lexicographically by steps
+ * @param e End of the scenarios
+ * @param depth Number of losses that are done in S
+ * @param apl Rotations as unitaries repr. as single line unitaries
+ * @param leaf Called with the index of every scenario and the output of the circuit for it
+ */
+template<class K, class V, class R, class F>
+void circuitTrie(State<K, V, R>& S, int step, const std::vector<std::vector<int>>& steps, std::vector<size_t>::const_iterator b, std::vector<size_t>::const_iterator e, size_t depth, const std::array<std::vector<V>, 15>& apl, F& leaf){
+    std::vector<size_t>::const_iterator it = b, g;
+    State<K, V, R> T;
+    int s;
+    if (it != e && steps[*it].size() == depth){ //scenarios without further loss sort first
+        T = S;
+        circuitFid(T, {}, apl, step);
+        for (; it != e && steps[*it].size() == depth; it++)
+            leaf(*it, T);
     }
-    for (typename State<Key<int>, float, float>::iterator it = SKeyIter.begin(); it!=SKeyIter.end();it++){
-        STemp = SFullDist;
-        SVecTemp = SVec;
-        compVecTemp = compVec;
-        collapseRenorm(it->first, SVecTemp, compVecTemp, temp);
-        SarS.push_back(std::move(SVecTemp));
-        SarComp.push_back(std::move(compVecTemp));
+    while (it != e){
+        s = steps[*it][depth];
+        for (g = it; g != e && steps[*g][depth] == s; g++);
+        circuitFid(S, {}, apl, step, s); //shared prefix up to the branching step
+        step = s;
+        T = S;
+        circuitFid(T, {circuitSteps()[s].arg}, apl, s, s+1);
+        circuitTrie(T, s+1, steps, it, g, depth+1, apl, leaf);
+        it = g;
+    }
+}
+
+/**
+ * @brief Computes the fidelity for many scenarios of loss and two-photon preparation, cf. fidsim(). The scenarios are organized as a trie over doublePrep and
+ * the canonical loss positions (cf. canonicalLoss()), such that the circuit for a shared prefix of the losses is run once (cf. circuitTrie()). Equivalent
+ * scenarios are computed once and their results are written for all of them. The results are written in the order of the trie.
+ * 
+ * @tparam K Key-type, cf. State
+ * @tparam V Value-type, cf. State
+ * @tparam R Real-type, cf. State
+ * @param ovls Overlaps, for all of them the fidelity is computed
+ * @param doublePreps Spatial modes with two-photon preparation, one vector per scenario
+ * @param lossPoss Positions where loss happens, one vector per scenario
+ * @param angErrs Rotation-errors for wave-plates
+ * @param apl Rotations as unitaries repr. as single line unitaries (already including the rotation errors)
+ * @param path Pathsuffix where to save the outcome
+ * @param rank Rank of the process (used for saving the outcome)
+ * @param perOutcome If set, the probability and fidelity of every outcome are written, otherwise only the aggregate over all outcomes, cf. fidWrite()
+ * @param done If set, called with the index of every finished scenario and its total probability and fidelity for every overlap, cf. fidResults()
+ * @param snapshots If set, the circuit up to the first rotation is loaded from or saved to snapshots with this pathprefix, cf. fidSnapshot(). The
+ * prefixes are then only shared between scenarios with the same losses before the first rotation.
+ */
+template<class K = Key<int>, class V, class R>
+void fidsimTrie(const std::vector<R>& ovls, const std::vector<std::vector<int>>& doublePreps, const std::vector<std::vector<int>>& lossPoss, const std::vector<R>& angErrs, const std::array<std::vector<V>, 15>& apl, const std::string& path, int rank, bool perOutcome = true, std::function<void(size_t, const std::vector<std::vector<R>>&)> done = nullptr, const std::string& snapshots = ""){
+    std::vector<std::vector<int>> preps(doublePreps.size()), losses(lossPoss.size()), steps(lossPoss.size()), early(lossPoss.size());
+    const int first = firstRotationStep();
+    std::vector<size_t> idx(doublePreps.size());
+    for (size_t i = 0; i<idx.size(); i++){
+        idx[i] = i;
+        preps[i] = doublePreps[i];
+        std::sort(preps[i].begin(), preps[i].end());
+        preps[i].erase(std::unique(preps[i].begin(), preps[i].end()), preps[i].end());
+        losses[i] = canonicalLoss(lossPoss[i]);
+        for (int p : losses[i])
+            steps[i].push_back(lossStep(p));
+        if (!snapshots.empty()) early[i].assign(steps[i].begin(), std::lower_bound(steps[i].begin(), steps[i].end(), first));
+    }
+    std::sort(idx.begin(), idx.end(), [&preps, &early, &steps](size_t a, size_t b){return std::tie(preps[a], early[a], steps[a]) < std::tie(preps[b], early[b], steps[b]);});
+    std::vector<std::vector<size_t>> same(idx.size());
+    std::vector<size_t> reps;
+    for (size_t i : idx){ //equivalent scenarios are computed once, cf. canonicalLoss()
+        if (!reps.empty() && preps[i] == preps[reps.back()] && steps[i] == steps[reps.back()])
+            same[reps.back()].push_back(i);
+        else {
+            reps.push_back(i);
+            same[i].push_back(i);
+        }
+    }
+    idx = std::move(reps);
+    reps.clear();
+    for (size_t i : idx){ //scenarios without accepted events are written directly, cf. fidFeasible()
+        if (fidFeasible(preps[i], losses[i])){
+            reps.push_back(i);
+            continue;
+        }
+        LaneAcc<K, V, R> StV(ovls.size()), StV2(ovls.size());
+        std::vector<std::vector<R>> res;
+        if (done) res = fidResults(StV, StV2, false);
+        for (size_t j : same[i]){
+            fidWrite(StV, StV2, ovls, angErrs, doublePreps[j], lossPoss[j], path, rank, perOutcome);
+            if (done) done(j, res);
+        }
     }
-    for (float o : ovls)
-        fid(SarS, SarComp, o, angErrs, doublePrep, lossPos, path, rank);
+    idx = std::move(reps);
+    auto leaf = [&](size_t i, const State<K, V, R>& S){
+        State<K, V, R> SFullDist = S, SKeyIter;
+        std::array<State<K, V, R>, 8> SVec, compVec;
+        LaneAcc<K, V, R> StV, StV2;
+        fidSplit(preps[i], SFullDist, SVec, compVec, SKeyIter);
+        fidAccumulate(ovls, SFullDist, SVec, compVec, SKeyIter, StV, StV2);
+        std::vector<std::vector<R>> res;
+        if (done) res = fidResults(StV, StV2, false);
+        for (size_t j : same[i]){
+            fidWrite(StV, StV2, ovls, angErrs, doublePreps[j], lossPoss[j], path, rank, perOutcome);
+            if (done) done(j, res);
+        }
+    };
+    std::vector<size_t>::const_iterator it = idx.cbegin(), g;
+    State<K, V, R> S;
+    while (it != idx.cend()){
+        for (g = it; g != idx.cend() && preps[*g] == preps[*it] && early[*g] == early[*it]; g++);
+        S = State<K, V, R>();
+        if (snapshots.empty()){
+            fidInit(preps[*it], S);
+            circuitTrie(S, 0, steps, it, g, 0, apl, leaf);
+        } else {
+            fidSnapshot(preps[*it], losses[*it], S, snapshots, rank);
+            circuitTrie(S, first, steps, it, g, early[*it].size(), apl, leaf);
+        }
+        it = g;
+    }
+}
+
+/**
+ * @brief Enumerates the combinations of loss and two-photon creation of schedulerGHZshuffled() in the order of their numbers: no error, one two-photon
+ * creation and one loss, two of each, three of each.
+ * 
+ * @param upper Number of combinations
+ * @param doublePreps Output: spatial modes with two-photon preparation, one vector per combination
+ * @param lossPoss Output: positions where loss happens, one vector per combination
+ */
+inline void ghzScenarios(size_t upper, std::vector<std::vector<int>>& doublePreps, std::vector<std::vector<int>>& lossPoss){
+    doublePreps.clear();
+    lossPoss.clear();
+    if (upper == 0) return;
+    doublePreps.push_back({}); //no error
+    lossPoss.push_back({});
+    for (int i=0;i<6;i++) //single error comb.
+    	for (int j=0;j<37;j++){
+            if (doublePreps.size() >= upper) return;
+            doublePreps.push_back({i});
+            lossPoss.push_back({j});
+    	}
+    for (int i0=0;i0<5;i0++) //two error combs.
+    	for (int i1=i0+1;i1<6;i1++)
+    		for (int j0=0;j0<36;j0++)
+    			for (int j1=j0+1;j1<37;j1++){
+                    if (doublePreps.size() >= upper) return;
+                    doublePreps.push_back({i0, i1});
+                    lossPoss.push_back({j0, j1});
+    			}
+    for (int i0=0;i0<4;i0++)
+    	for (int i1=i0+1;i1<5;i1++)
+    		for (int i2=i1+1;i2<6;i2++)
+    			for (int j0=0;j0<35;j0++)
+    				for (int j1=j0+1;j1<36;j1++)
+    					for (int j2=j1+1;j2<37;j2++){
+                            if (doublePreps.size() >= upper) return;
+                            doublePreps.push_back({i0, i1, i2});
+                            lossPoss.push_back({j0, j1, j2});
+    					}
 }
 
 /**
  * @brief This function iterates over most likely 10214 combinations of loss and two-photon creation and saves the fidelity and the probailities for all of them.
+ * The combinations of this process are run together with shared circuit prefixes, cf. fidsimTrie().
  * 
+ * @tparam K Key-type, cf. State
+ * @tparam V Value-type, cf. State. Defaults to R, e.g. std::complex<float> has to be given explicitly
+ * @tparam R Real-type, cf. State
  * @param ovls Overlaps, for all of them the fidelity is computed
  * @param angErrs Rotation-errors for wave-plates
  * @param path Pathsuffix where to save the outcome
@@ -222,10 +1604,10 @@ void fidsim(const std::vector<float>& ovls, const std::vector<int>& doublePrep,
  * @param rank Rank of the process (used for saving the outcome)
  * @param size Number of processes
  * @param shuffle_path Path to a file where all 10214 combinations are shuffeled
+ * @param snapshot_path If set, pathprefix of the snapshots of the circuit up to the first rotation, which are shared by runs with other rotation errors, cf. fidSnapshot()
  */
-void schedulerGHZshuffled(const std::vector<float>& ovls, std::vector<float>& angErrs, std::string path, int global_lower, int global_upper, int rank_off, int rank, int size, std::string shuffle_path){
-    int n=global_upper-global_lower;
-    int count = 0;
+template<class K = Key<int>, class R, class V = R>
+void schedulerGHZshuffled(const std::vector<R>& ovls, std::vector<R>& angErrs, std::string path, int global_lower, int global_upper, int rank_off, int rank, int size, std::string shuffle_path, std::string snapshot_path = ""){
     std::vector<int> todo;
     std::ifstream infile(shuffle_path);
     int i = 0, p;
@@ -235,56 +1617,311 @@ void schedulerGHZshuffled(const std::vector<float>& ovls, std::vector<float>& an
         }
         i++;
     }
-    std::vector<int> p2 = {}, pl={};
-    std::array<std::vector<float>, 15> apl = genRotationsBasic<float, float>(angErrs);
-    if (std::find(todo.begin(), todo.end(), count)!= todo.end()) {fidsim(ovls, p2, pl, angErrs, apl, path, rank+rank_off);
-    ;std::cout << count << std::endl;} //no error
-	if (count>global_upper) return;
-    for (int i=0;i<6;i++){ //single error comb.
-    	p2 = {i};
-    	for (int j=0;j<37;j++){
-    		pl = {j};
-    		count++;
-    		if (std::find(todo.begin(), todo.end(), count)!= todo.end()) {fidsim(ovls, p2, pl, angErrs, apl, path, rank+rank_off);
-    ;std::cout << count << std::endl;}
-			if (count>global_upper) return;
-    	}
-    }
+    std::vector<std::vector<int>> allPreps, allLoss, preps, loss;
+    std::vector<int> kept; //scenario numbers of preps and loss
+    ghzScenarios(std::max(global_upper, 0), allPreps, allLoss);
+    for (int c : todo)
+        if ((size_t) c < allPreps.size()){
+            preps.push_back(allPreps[c]);
+            loss.push_back(allLoss[c]);
+            kept.push_back(c);
+        }
+    std::array<std::vector<V>, 15> apl = genRotationsBasic<V, R>(angErrs);
+    std::cerr << "kernels: " << kernelISA() << std::endl;
+    fidsimTrie<K>(ovls, preps, loss, angErrs, apl, path, rank+rank_off, true, std::function<void(size_t, const std::vector<std::vector<R>>&)>([&kept](size_t j, const std::vector<std::vector<R>>&){std::cout << kept[j] << std::endl;}), snapshot_path);
+}
 
-    for (int i0=0;i0<5;i0++){ //two error combs.
-    	for (int i1=i0+1;i1<6;i1++){
-    		p2 = {i0, i1};
-    		for (int j0=0;j0<36;j0++){
-    			for (int j1=j0+1;j1<37;j1++){
-    				pl = {j0, j1};
-    				count++;
-    				if (std::find(todo.begin(), todo.end(), count)!= todo.end()) {fidsim(ovls, p2, pl, angErrs, apl, path, rank+rank_off);
-    ;std::cout << count << std::endl;}
-					if (count>global_upper) return;
-    			}
-    		}
-    	}
+/**
+ * @brief Enumerates the scenarios of loss and two-photon creation in decreasing prior probability, for independent events with the given probabilities.
+ * Every event is toggled against its more likely state, such that a scenario has the probability of the base scenario times the odds of its toggled
+ * events. With the odds sorted decreasingly, the subsets of toggled events are visited best-first: the successors of a subset with largest event k
+ * add event k+1 or replace k by k+1, which are both less likely. The number of errors is not limited, the enumeration stops when the probability of
+ * all remaining scenarios is below tol or limit scenarios are found.
+ * 
+ * @param lossProbs Probability of loss for every position, cf. circuitSteps()
+ * @param doubleProbs Probability of two-photon creation for every source
+ * @param tol Tolerance for the probability of the remaining scenarios
+ * @param doublePreps Output: spatial modes with two-photon preparation, one vector per scenario
+ * @param lossPoss Output: positions where loss happens, one vector per scenario
+ * @param weights Output: prior probability of every scenario
+ * @param limit Maximal number of scenarios
+ * @return double Probability of the scenarios that are not enumerated
+ */
+inline double budgetScenarios(const std::vector<double>& lossProbs, const std::vector<double>& doubleProbs, double tol, std::vector<std::vector<int>>& doublePreps, std::vector<std::vector<int>>& lossPoss, std::vector<double>& weights, size_t limit = 100000){
+    struct Event{bool loss; int pos; double odds;};
+    std::vector<Event> ev;
+    std::vector<int> baseDouble, baseLoss;
+    double w0 = 1, p;
+    for (size_t k = 0; k<doubleProbs.size()+lossProbs.size(); k++){
+        bool loss = k >= doubleProbs.size();
+        int pos = loss ? k-doubleProbs.size() : k;
+        p = loss ? lossProbs[pos] : doubleProbs[pos];
+        if (p > 0.5)
+            (loss ? baseLoss : baseDouble).push_back(pos);
+        w0 *= std::max(p, 1-p);
+        if (p > 0 && p < 1)
+            ev.push_back({loss, pos, std::min(p, 1-p)/std::max(p, 1-p)});
     }
-
-    for (int i0=0;i0<4;i0++){
-    	for (int i1=i0+1;i1<5;i1++){
-    		for (int i2=i1+1;i2<6;i2++){
-    			p2 = {i0, i1, i2};
-    			for (int j0=0;j0<35;j0++){
-    				for (int j1=j0+1;j1<36;j1++){
-    					for (int j2=j1+1;j2<37;j2++){
-    						pl = {j0, j1, j2};
-		    				count++;
-		    				if (std::find(todo.begin(), todo.end(), count)!= todo.end()) {fidsim(ovls, p2, pl, angErrs, apl, path, rank+rank_off);
-    ;std::cout << count << std::endl;}
-							if (count>global_upper) return;
-    					}
-    				}
-    			}    		
-    		}
-    	}
+    std::stable_sort(ev.begin(), ev.end(), [](const Event& a, const Event& b){return a.odds > b.odds;});
+    auto cmp = [](const std::pair<double, std::vector<int>>& a, const std::pair<double, std::vector<int>>& b){return a.first < b.first;};
+    std::priority_queue<std::pair<double, std::vector<int>>, std::vector<std::pair<double, std::vector<int>>>, decltype(cmp)> q(cmp);
+    std::vector<int> dp, lp;
+    double rest = 1;
+    doublePreps.clear();
+    lossPoss.clear();
+    weights.clear();
+    q.push({w0, {}});
+    while (!q.empty() && rest >= tol && weights.size() < limit){
+        std::pair<double, std::vector<int>> t = q.top();
+        q.pop();
+        dp = baseDouble;
+        lp = baseLoss;
+        for (int k : t.second){ //toggles the event against its base state
+            std::vector<int>& v = ev[k].loss ? lp : dp;
+            std::vector<int>::iterator it = std::find(v.begin(), v.end(), ev[k].pos);
+            if (it == v.end()) v.push_back(ev[k].pos);
+            else v.erase(it);
+        }
+        std::sort(dp.begin(), dp.end());
+        std::sort(lp.begin(), lp.end());
+        doublePreps.push_back(dp);
+        lossPoss.push_back(lp);
+        weights.push_back(t.first);
+        rest -= t.first;
+        int k = t.second.empty() ? -1 : t.second.back();
+        if (k+1 < (int) ev.size()){
+            std::vector<int> a = t.second;
+            a.push_back(k+1);
+            q.push({t.first*ev[k+1].odds, a});
+            if (k >= 0){
+                a.erase(a.end()-2);
+                q.push({t.first/ev[k].odds*ev[k+1].odds, a});
+            }
+        }
     }
+    return std::max(rest, 0.0);
+}
+
+/**
+ * @brief Computes the fidelity for the most likely scenarios of loss and two-photon creation, for independent events with the given probabilities, cf.
+ * budgetScenarios(). Unlike schedulerGHZshuffled() the number of errors is not limited, the scenarios are visited in decreasing prior probability until
+ * the remaining probability is below tol. Every scenario is written as in fidsim(). Additionally, the prior-weighted acceptance probability P and
+ * fidelity F of the visited scenarios are written to path+"budget"+rank, one line per overlap with:
+ * ovl, visited probability, remaining probability m, sum of w*P, sum of w*P*F, lower bound, estimate and upper bound of F.
+ * As P and F are between 0 and 1 for the remaining scenarios, F is bounded by sum(w*P*F)/(sum(w*P)+m) and (sum(w*P*F)+m)/(sum(w*P)+m). With several
+ * processes, every process visits a share of the scenarios and m also contains the scenarios of the other processes, the sums of all processes
+ * can be added for the bound of all of them.
+ * 
+ * @tparam K Key-type, cf. State
+ * @tparam V Value-type, cf. State. Defaults to R, e.g. std::complex<float> has to be given explicitly
+ * @tparam R Real-type, cf. State
+ * @param ovls Overlaps, for all of them the fidelity is computed
+ * @param angErrs Rotation-errors for wave-plates
+ * @param lossProbs Probability of loss for every position, cf. circuitSteps()
+ * @param doubleProbs Probability of two-photon creation for every source
+ * @param tol Tolerance for the probability of the scenarios that are not visited
+ * @param path Pathsuffix where to save the outcome
+ * @param rank_off Offset for the rank, which is used for saving the result
+ * @param rank Rank of the process (used for saving the outcome)
+ * @param size Number of processes
+ * @param snapshot_path If set, pathprefix of the snapshots of the circuit up to the first rotation, cf. fidSnapshot()
+ * @param limit Maximal number of scenarios, cf. budgetScenarios()
+ */
+template<class K = Key<int>, class R, class V = R>
+void schedulerGHZbudget(const std::vector<R>& ovls, std::vector<R>& angErrs, const std::vector<double>& lossProbs, const std::vector<double>& doubleProbs, double tol, std::string path, int rank_off, int rank, int size, std::string snapshot_path = "", size_t limit = 100000){
+    std::vector<std::vector<int>> allPreps, allLoss, preps, loss;
+    std::vector<double> allW, w;
+    std::vector<size_t> todo;
+    double rest = budgetScenarios(lossProbs, doubleProbs, tol, allPreps, allLoss, allW, limit), visited = 0;
+    for (size_t i = 0; i<allW.size(); i++)
+        if ((int) (i%size) == rank){
+            preps.push_back(allPreps[i]);
+            loss.push_back(allLoss[i]);
+            w.push_back(allW[i]);
+            todo.push_back(i);
+            visited += allW[i];
+        }
+    std::cerr << "scenarios: " << allW.size() << ", remaining probability: " << rest << std::endl;
+    std::vector<double> wp(ovls.size(), 0.0), wpf(ovls.size(), 0.0);
+    std::array<std::vector<V>, 15> apl = genRotationsBasic<V, R>(angErrs);
+    std::cerr << "kernels: " << kernelISA() << std::endl;
+    std::function<void(size_t, const std::vector<std::vector<R>>&)> done = [&](size_t j, const std::vector<std::vector<R>>& res){
+        for (size_t o=0; o<ovls.size(); o++)
+            if (res[o][0] > 0){ //the fidelity of a scenario without accepted events is 0/0
+                wp[o] += w[j]*res[o][0];
+                wpf[o] += w[j]*res[o][0]*res[o][1];
+            }
+        std::cout << todo[j] << std::endl;
+    };
+    fidsimTrie<K>(ovls, preps, loss, angErrs, apl, path, rank+rank_off, true, done, snapshot_path);
+    double m = 1-visited;
+    std::ofstream myfile;
+    myfile.open(path+"budget"+std::to_string(rank+rank_off)+".txt", std::ios_base::app);
+    for (size_t o=0; o<ovls.size(); o++)
+        myfile << std::setprecision(6) << ovls[o] << " " << std::setprecision(12) << visited << " " << m << " " << wp[o] << " " << wpf[o] << " " << wpf[o]/(wp[o]+m) << " " << wpf[o]/wp[o] << " " << (wpf[o]+m)/(wp[o]+m) << "\n";
+    myfile.close();
+}
+
+/**
+ * @brief Prior probability of a scenario for independent events of loss and two-photon creation, cf. budgetScenarios().
+ * 
+ * @param doublePrep Spatial modes with two-photon preparation
+ * @param lossPos Positions where loss happens
+ * @param lossProbs Probability of loss for every position
+ * @param doubleProbs Probability of two-photon creation for every source
+ * @return double Probability
+ */
+inline double scenarioProb(const std::vector<int>& doublePrep, const std::vector<int>& lossPos, const std::vector<double>& lossProbs, const std::vector<double>& doubleProbs){
+    double w = 1;
+    for (int i = 0; i<(int) doubleProbs.size(); i++)
+        w *= std::find(doublePrep.cbegin(), doublePrep.cend(), i) != doublePrep.cend() ? doubleProbs[i] : 1-doubleProbs[i];
+    for (int j = 0; j<(int) lossProbs.size(); j++)
+        w *= std::find(lossPos.cbegin(), lossPos.cend(), j) != lossPos.cend() ? lossProbs[j] : 1-lossProbs[j];
+    return w;
+}
+
+/**
+ * @brief Estimates the acceptance probability P and the fidelity F averaged over the imperfections by sampling, for high error orders where the enumeration
+ * of schedulerGHZshuffled() or schedulerGHZbudget() is infeasible. Every sample draws the two-photon creations and losses as independent events and
+ * normally distributed rotation errors, and is simulated and written as in fidsim().
+ * 
+ * The samples are either pseudo-random or quasi-random (cf. quasiAlpha()). Quasi-random points are drawn in rounds over replicates, one randomly shifted
+ * sequence per replicate, and the confidence intervals are computed from the means of the replicates.
+ * 
+ * The scenarios with at most one error are computed exactly at the mean rotation errors before sampling. Their result is used as control variate c of a
+ * sample, with 0 for more errors, whose expectation is known exactly. P and P*F are estimated by the mean of y = f-beta*(c-E[c]) with the
+ * variance-minimizing beta, F by their ratio with the confidence interval of the delta method. After every sample (every round for quasi-random points),
+ * the running estimates are written to path+"mc"+rank, one line per overlap with:
+ * number of samples, ovl, P, half-width of P, P*F, half-width of P*F, F, half-width of F.
+ * The estimates start after 10 pseudo-random samples or two rounds of quasi-random samples. The sampling stops when the half-width of the 95% confidence
+ * interval of F is below target for all overlaps or after maxSamples samples.
+ * 
+ * @tparam K Key-type, cf. State
+ * @tparam V Value-type, cf. State. Defaults to R, e.g. std::complex<float> has to be given explicitly
+ * @tparam R Real-type, cf. State
+ * @param ovls Overlaps, for all of them the fidelity is computed
+ * @param angMeans Means of the rotation errors, in degree
+ * @param angSigmas Standard deviations of the rotation errors, in degree
+ * @param lossProbs Probability of loss for every position, cf. circuitSteps()
+ * @param doubleProbs Probability of two-photon creation for every source
+ * @param target Half-width of the confidence interval of F
+ * @param maxSamples Maximal number of samples
+ * @param quasi If set, quasi-random points are used, otherwise pseudo-random points
+ * @param path Pathsuffix where to save the outcome, the exact scenarios are saved to path+"cv"
+ * @param rank Rank of the process (used for saving the outcome and as offset of the seed)
+ * @param seed Seed of the random numbers
+ * @param replicates Number of randomly shifted sequences for quasi-random points
+ */
+template<class K = Key<int>, class R, class V = R>
+void schedulerGHZsampling(const std::vector<R>& ovls, const std::vector<R>& angMeans, const std::vector<R>& angSigmas, const std::vector<double>& lossProbs, const std::vector<double>& doubleProbs, double target, size_t maxSamples, bool quasi, std::string path, int rank, unsigned seed = 1, int replicates = 8){
+    const int nd = doubleProbs.size(), nl = lossProbs.size();
+    const size_t d = nd+nl+angMeans.size(), no = ovls.size();
+    std::map<std::pair<std::vector<int>, std::vector<int>>, std::vector<std::array<double, 2>>> exact; //P and P*F at the mean rotation errors
+    std::vector<std::vector<int>> preps = {{}}, loss = {{}};
+    for (int i = 0; i<nd; i++)
+        if (doubleProbs[i] > 0){
+            preps.push_back({i});
+            loss.push_back({});
+        }
+    for (int j = 0; j<nl; j++)
+        if (lossProbs[j] > 0){
+            preps.push_back({});
+            loss.push_back({j});
+        }
+    std::vector<std::array<double, 2>> mu(no, {0.0, 0.0}); //E[c]
+    std::function<void(size_t, const std::vector<std::vector<R>>&)> done = [&](size_t j, const std::vector<std::vector<R>>& res){
+        std::vector<std::array<double, 2>>& e = exact[{preps[j], loss[j]}];
+        double w = scenarioProb(preps[j], loss[j], lossProbs, doubleProbs);
+        e.assign(no, {0.0, 0.0});
+        for (size_t o=0; o<no; o++){
+            if (res[o][0] > 0) e[o] = {(double) res[o][0], (double) res[o][0]*res[o][1]};
+            mu[o][0] += w*e[o][0];
+            mu[o][1] += w*e[o][1];
+        }
+    };
+    fidsimTrie<K>(ovls, preps, loss, angMeans, genRotationsBasic<V, R>(angMeans), path+"cv", rank, true, done);
 
+    std::mt19937_64 gen(seed+rank);
+    std::uniform_real_distribution<double> unif(0.0, 1.0);
+    std::vector<double> alpha = quasiAlpha(d), u(d);
+    std::vector<std::vector<double>> shift(quasi ? replicates : 0, std::vector<double>(d));
+    for (std::vector<double>& sh : shift)
+        for (double& x : sh) x = unif(gen);
+    std::vector<std::vector<std::array<double, 2>>> f, c; //per sample and overlap: P and P*F, and their control variates
+    std::vector<double> est(no, 0.0), half(no, 0.0); //last estimate of F and the half-width of its confidence interval
+    bool estimated = false;
+    std::vector<int> dp, lp;
+    std::vector<R> errs(angMeans.size());
+    for (size_t n = 0; n<maxSamples; n++){
+        for (size_t k = 0; k<d; k++)
+            u[k] = quasi ? std::fmod(shift[n%replicates][k]+(n/replicates+1)*alpha[k], 1.0) : unif(gen);
+        dp.clear();
+        lp.clear();
+        for (int i = 0; i<nd; i++)
+            if (u[i] < doubleProbs[i]) dp.push_back(i);
+        for (int j = 0; j<nl; j++)
+            if (u[nd+j] < lossProbs[j]) lp.push_back(j);
+        for (size_t k = 0; k<errs.size(); k++)
+            errs[k] = (R) (angMeans[k]+angSigmas[k]*invNormal(std::min(std::max(u[nd+nl+k], 1e-300), 1-1e-16)));
+        LaneAcc<K, V, R> StV, StV2;
+        fidAccumulate(ovls, dp, lp, genRotationsBasic<V, R>(errs), StV, StV2);
+        fidWrite(StV, StV2, ovls, errs, dp, lp, path, rank);
+        std::vector<std::vector<R>> res = fidResults(StV, StV2, false);
+        f.emplace_back(no, std::array<double, 2>{0.0, 0.0});
+        c.emplace_back(no, std::array<double, 2>{0.0, 0.0});
+        auto it = exact.find({dp, lp});
+        for (size_t o=0; o<no; o++){
+            if (res[o][0] > 0) f.back()[o] = {(double) res[o][0], (double) res[o][0]*res[o][1]};
+            if (it != exact.end()) c.back()[o] = it->second[o];
+        }
+        if ((quasi && (n+1)%replicates != 0) || f.size() < (size_t) (quasi ? 2*replicates : 10)) //beta is fitted to the samples, too few of them give no interval
+            continue;
+        //units of the confidence intervals: the samples, or the means of the replicates
+        size_t m = f.size(), units = quasi ? replicates : m;
+        bool reached = true;
+        std::ofstream myfile;
+        myfile.open(path+"mc"+std::to_string(rank)+".txt", std::ios_base::app);
+        for (size_t o=0; o<no; o++){
+            std::array<double, 2> mean, se;
+            std::array<std::vector<double>, 2> y;
+            for (int q = 0; q<2; q++){
+                double fm = 0, cm = 0, cov = 0, var = 0, beta;
+                for (size_t s = 0; s<m; s++){
+                    fm += f[s][o][q]/m;
+                    cm += c[s][o][q]/m;
+                }
+                for (size_t s = 0; s<m; s++){
+                    cov += (f[s][o][q]-fm)*(c[s][o][q]-cm);
+                    var += (c[s][o][q]-cm)*(c[s][o][q]-cm);
+                }
+                beta = var > 0 ? cov/var : 0;
+                y[q].assign(units, 0.0);
+                for (size_t s = 0; s<m; s++)
+                    y[q][quasi ? s%replicates : s] += (f[s][o][q]-beta*(c[s][o][q]-mu[o][q]))/(m/units);
+                mean[q] = 0;
+                for (double x : y[q]) mean[q] += x/units;
+                se[q] = 0;
+                for (double x : y[q]) se[q] += (x-mean[q])*(x-mean[q])/(units-1)/units;
+                se[q] = std::sqrt(se[q]);
+            }
+            double r = mean[1]/mean[0], sr = 0;
+            for (size_t s = 0; s<units; s++) //delta method for the ratio
+                sr += std::pow((y[1][s]-mean[1])-r*(y[0][s]-mean[0]), 2)/(units-1)/units;
+            sr = std::sqrt(sr)/std::abs(mean[0]);
+            myfile << m << " " << std::setprecision(6) << ovls[o] << " " << std::setprecision(12) << mean[0] << " " << 1.96*se[0] << " " << mean[1] << " " << 1.96*se[1] << " " << r << " " << 1.96*sr << "\n";
+            est[o] = r;
+            half[o] = 1.96*sr;
+            reached = reached && 1.96*sr < target;
+        }
+        myfile.close();
+        estimated = true;
+        if (reached) break;
+    }
+    std::cout << "samples: " << f.size();
+    if (estimated)
+        for (size_t o=0; o<no; o++)
+            std::cout << ", F(" << ovls[o] << "): " << est[o] << " +- " << half[o];
+    std::cout << std::endl;
 }
 
 #endif
\ No newline at end of file
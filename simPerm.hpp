@@ -0,0 +1,288 @@
+/**
+ * @file simPerm.hpp
+ * @author Fabian Wiesner (fabian.wiesner97@gmail.com)
+ * @brief Computes outcome probabilities under partial distinguishability from the transfer matrix of the circuit and a uniform pairwise overlap, without enumerating DMode configurations.
+ * @version 0.1
+ * @date 2024-06-06
+ *
+ * @copyright Copyright (c) 2024, provided under CC BY-NC 4.0. license
+ *
+ */
+
+ /*
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef SIMPERM_HPP
+#define SIMPERM_HPP
+#include "State.hpp"
+#include "Key.hpp"
+#include "simAux.hpp"
+#include "simFid.hpp"
+
+/*
+Photons of source s have the internal state sqrt(ovl) e_0 + sqrt(1-ovl) e_s with orthonormal e, i.e. the pairwise overlap ovl. Expanding the product of
+the sources, c_s of the n_s photons of source s are in the common internal mode e_0 with weight binom(n_s, c_s) ovl^c_s (1-ovl)^(n_s-c_s), the others
+in the private mode e_s, and the terms for different c are orthogonal. Photons in different internal modes do not interfere, such that the output
+photons are split into the common group and the private groups. With the output photons as positions l and M[s][l] the amplitude from the input mode of
+source s to the output mode of l, the probability of an output pattern is
+
+    prod_s n_s! / prod_m out_m! * sum_c ovl^|c| (1-ovl)^(n-|c|) * sum_P |E_c(P)|^2 F_c(P^c),
+
+where E_c(P) sums prod_s prod_{l in A_s} M[s][l] over the splits of the positions P into sets A_s of size c_s, and F_c the same for |M|^2 and sizes n_s-c_s
+(cf. assignStep()). The cost is the number of choices of c times the number of subsets of the output photons, instead of n! permanents of n x n
+matrices in the expansion over the permutations.
+*/
+
+/**
+ * @brief Transfer matrix of circuitFid() without loss, obtained by sending single photons through the circuit.
+ *
+ * @tparam K Key-type, cf. State
+ * @tparam V Value-type, cf. State
+ * @tparam R Real-type, cf. State
+ * @param apl Rotations as unitaries repr. as single line unitaries
+ * @return std::vector<std::vector<V>> T[a][b] is the amplitude of a photon from S&P mode a to end in S&P mode b
+ */
+template<class K, class V, class R>
+inline std::vector<std::vector<V>> transferMatrix(const std::array<std::vector<V>, 15>& apl){
+    std::vector<std::vector<V>> T(12, std::vector<V>(12, 0.0));
+    for (int a = 0; a<12; a++){
+        State<K, V, R> S(K(a, 0, 1));
+        S.set((typename K::basetype) 12);
+        circuitFid(S, {}, apl);
+        for (typename State<K, V, R>::iterator it = S.begin(); it!=S.end(); it++)
+            T[a][it->first.cbegin()->first.first] = it->second;
+    }
+    return T;
+}
+
+/**
+ * @brief Multiplicity normalization of a mode list, i.e. the product of the faculties of the occupation numbers.
+ *
+ * @param modes One mode per photon
+ * @return int Product of the faculties of the occupation numbers
+ */
+inline int multFac(const std::vector<int>& modes){
+    boost::container::flat_map<int, int> occ;
+    for (int m : modes) occ[m]++;
+    int r = 1;
+    for (boost::container::flat_map<int, int>::const_iterator it = occ.cbegin(); it != occ.cend(); it++)
+        r *= facut(it->second);
+    return r;
+}
+
+/**
+ * @brief Adds the weights of all sets of cnt output photons outside of mask, starting at photon l, cf. assignStep().
+ *
+ * @tparam W Weight type
+ * @param a a[l] weight of output photon l
+ * @param n Number of output photons
+ * @param l First photon that may be added
+ * @param cnt Number of photons that are still added
+ * @param mask Photons that are taken
+ * @param w Weight of the photons added so far
+ * @param next Output: weights are added at the extended masks
+ * @param nextMasks Output: extended masks are appended, possibly repeated
+ */
+template<class W>
+inline void assignAdd(const std::vector<W>& a, size_t n, size_t l, int cnt, unsigned mask, const W& w, std::vector<W>& next, std::vector<unsigned>& nextMasks){
+    if (cnt == 0){
+        nextMasks.push_back(mask);
+        next[mask] += w;
+        return;
+    }
+    for (; l+cnt <= n; l++)
+        if (!(mask & (1u << l)))
+            assignAdd(a, n, l+1, cnt-1, mask | (1u << l), w*a[l], next, nextMasks);
+}
+
+/**
+ * @brief Adds the group of one source to sums of products over the splits of subsets of the output photons into groups, cf. simPerm.hpp.
+ * For every subset P of the output photons (as bit mask) cur holds the sum over the splits of P into the groups so far, the step adds a group of cnt
+ * photons with weights a.
+ *
+ * @tparam W Weight type
+ * @param a a[l] weight of output photon l in the group
+ * @param cnt Size of the group
+ * @param cur Sums before the step, indexed by the mask
+ * @param masks Masks with nonzero sums in cur
+ * @param next Output: sums after the step, has to be zero at all masks before
+ * @param nextMasks Output: masks with nonzero sums in next
+ */
+template<class W>
+inline void assignStep(const std::vector<W>& a, int cnt, const std::vector<W>& cur, const std::vector<unsigned>& masks, std::vector<W>& next, std::vector<unsigned>& nextMasks){
+    nextMasks.clear();
+    for (unsigned mask : masks)
+        assignAdd(a, a.size(), 0, cnt, mask, cur[mask], next, nextMasks);
+    std::sort(nextMasks.begin(), nextMasks.end());
+    nextMasks.erase(std::unique(nextMasks.begin(), nextMasks.end()), nextMasks.end());
+}
+
+/**
+ * @brief Probability of an output pattern as polynomial in a uniform pairwise overlap of the sources, cf. simPerm.hpp. The splits into the common
+ * and the private groups are built source by source, such that the choices of c with the same first sources share their sums.
+ *
+ * @tparam V Value-type, cf. State
+ * @tparam R Real-type, cf. State
+ * @param T Transfer matrix, cf. transferMatrix()
+ * @param in Input S&P mode of every photon, the photons of a source share their mode
+ * @param out Output S&P mode of every photon
+ * @param src Source of every photon, photons of the same source are indistinguishable
+ * @return std::vector<R> Coefficients c, such that the probability is sum_m c[m] ovl^m
+ */
+template<class V, class R>
+inline std::vector<R> probPermPoly(const std::vector<std::vector<V>>& T, const std::vector<int>& in, const std::vector<int>& out, const std::vector<int>& src){
+    size_t n = in.size(), full = (size_t(1) << n)-1;
+    std::vector<int> srcs, num;
+    std::vector<std::vector<V>> M;
+    std::vector<std::vector<R>> M2;
+    for (size_t j = 0; j<n; j++){
+        size_t s = std::find(srcs.begin(), srcs.end(), src[j])-srcs.begin();
+        if (s < srcs.size()){
+            num[s]++;
+            continue;
+        }
+        srcs.push_back(src[j]);
+        num.push_back(1);
+        M.emplace_back(n);
+        M2.emplace_back(n);
+        for (size_t l = 0; l<n; l++){
+            M.back()[l] = T[in[j]][out[l]];
+            M2.back()[l] = (R) absSq(M.back()[l]);
+        }
+    }
+    size_t S = srcs.size();
+    R norm = 1.0;
+    for (int k : num) norm *= facut(k);
+    norm /= multFac(out);
+    std::vector<R> c(n+1, 0.0);
+    std::vector<std::vector<V>> E(S+1, std::vector<V>(full+1, 0.0));
+    std::vector<std::vector<R>> F(S+1, std::vector<R>(full+1, 0.0));
+    std::vector<std::vector<unsigned>> EMasks(S+1), FMasks(S+1);
+    E[0][0] = 1.0;
+    F[0][0] = 1.0;
+    EMasks[0] = {0};
+    FMasks[0] = {0};
+    std::function<void(size_t, size_t)> rec = [&](size_t s, size_t k){ //k photons in the common group so far
+        if (s == S){
+            R sum = 0;
+            for (unsigned mask : EMasks[S])
+                sum += (R) absSq(E[S][mask])*F[S][full ^ mask];
+            for (size_t j = 0; j+k<=n; j++) //ovl^k (1-ovl)^(n-k)
+                c[k+j] += ((j%2) ? -1 : 1)*binomialCoeff<R, size_t>(n-k, j)*sum*norm;
+            return;
+        }
+        for (int cs = 0; cs<=num[s]; cs++){
+            assignStep(M[s], cs, E[s], EMasks[s], E[s+1], EMasks[s+1]);
+            assignStep(M2[s], num[s]-cs, F[s], FMasks[s], F[s+1], FMasks[s+1]);
+            rec(s+1, k+cs);
+            for (unsigned mask : EMasks[s+1]) E[s+1][mask] = 0.0;
+            for (unsigned mask : FMasks[s+1]) F[s+1][mask] = 0.0;
+        }
+    };
+    rec(0, 0);
+    return c;
+}
+
+/**
+ * @brief Output patterns that are accepted for a measurement outcome of fidsim(), i.e. the measured modes match and one of {0, 6, 10}, {1, 7, 11} is fully occupied.
+ *
+ * @param n Number of photons
+ * @param p Measurement outcome p4+2*p2+4*p1, cf. fidsim()
+ * @return std::vector<std::vector<int>> Accepted patterns, one output mode per photon
+ */
+inline std::vector<std::vector<int>> acceptedPatterns(int n, int p){
+    int p1 = (p >> 2) & 1, p2 = (p >> 1) & 1, p4 = p & 1;
+    std::vector<int> meas = {2+p1, 4+p2, 8+p4}, free = {0, 1, 6, 7, 10, 11};
+    std::vector<std::vector<int>> res;
+    std::vector<int> occ(6, 0);
+    std::function<void(int, int)> rec = [&](int i, int left){
+        if (i == 5){
+            occ[5] = left;
+            if ((occ[0] && occ[2] && occ[4]) || (occ[1] && occ[3] && occ[5])){
+                std::vector<int> out = meas;
+                for (int k = 0; k<6; k++)
+                    for (int c = 0; c<occ[k]; c++) out.push_back(free[k]);
+                std::sort(out.begin(), out.end());
+                res.push_back(out);
+            }
+            return;
+        }
+        for (int c = 0; c<=left; c++){
+            occ[i] = c;
+            rec(i+1, left-c);
+        }
+    };
+    if (n >= 6) rec(0, n-3);
+    return res;
+}
+
+/**
+ * @brief Input S&P modes and sources of the photons for fidsim(), i.e. one photon per source in 2i and two for double-preparation.
+ *
+ * @param doublePrep Spatial modes with two-photon preparation
+ * @param in Output: input S&P mode of every photon
+ * @param src Output: source of every photon
+ */
+inline void inputPhotons(const std::vector<int>& doublePrep, std::vector<int>& in, std::vector<int>& src){
+    in.clear();
+    src.clear();
+    for (int i=0; i<6; i++){
+        int num = (std::find(doublePrep.begin(), doublePrep.end(), i)!=doublePrep.end()) ? 2 : 1;
+        for (int c = 0; c<num; c++){
+            in.push_back(2*i);
+            src.push_back(i);
+        }
+    }
+}
+
+/**
+ * @brief Probabilities of the 8 measurement outcomes of fidsim() as polynomials in a uniform pairwise overlap. Only valid without loss, as loss is not a linear map in this model.
+ *
+ * @param doublePrep Spatial modes with two-photon preparation
+ * @param apl Rotations as unitaries repr. as single line unitaries (already including the rotation errors)
+ * @return std::array<std::vector<float>, 8> Coefficients c for every measurement outcome, such that the probability is sum_m c[m] ovl^m
+ */
+inline std::array<std::vector<float>, 8> fidProbPermPoly(const std::vector<int>& doublePrep, const std::array<std::vector<float>, 15>& apl){
+    std::vector<std::vector<float>> T = transferMatrix<Key<int>, float, float>(apl);
+    std::vector<int> in, src;
+    inputPhotons(doublePrep, in, src);
+    std::array<std::vector<float>, 8> res;
+    std::vector<float> c;
+    for (int j = 0; j<8; j++){
+        res[j].assign(in.size()+1, 0.0);
+        for (const std::vector<int>& out : acceptedPatterns(in.size(), j)){
+            c = probPermPoly<float, float>(T, in, out, src);
+            for (size_t m = 0; m<c.size(); m++) res[j][m] += c[m];
+        }
+    }
+    return res;
+}
+
+/**
+ * @brief Probabilities of the 8 measurement outcomes of fidsim() for a uniform pairwise overlap, cf. fidProbPermPoly(). Only valid without loss.
+ *
+ * @param doublePrep Spatial modes with two-photon preparation
+ * @param apl Rotations as unitaries repr. as single line unitaries (already including the rotation errors)
+ * @param ovl Pairwise overlap of the sources
+ * @return std::vector<float> Probability for every measurement outcome, same order as in fid()
+ */
+inline std::vector<float> fidProbPerm(const std::vector<int>& doublePrep, const std::array<std::vector<float>, 15>& apl, float ovl){
+    std::array<std::vector<float>, 8> P = fidProbPermPoly(doublePrep, apl);
+    std::vector<float> res;
+    for (int j = 0; j<8; j++){
+        float p = 0;
+        for (size_t m = P[j].size(); m-- > 0;)
+            p = p*ovl+P[j][m];
+        res.push_back(p);
+    }
+    return res;
+}
+
+#endif